@@ -0,0 +1,89 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stdint.h>
+
+#include "config.h"
+#include "opcodes.h"
+
+typedef struct CPU CPU;
+typedef struct Memory Memory;
+
+// A single predecoded instruction
+typedef struct MicroOp {
+    opcode_fn handler; // Handler from opcode_table
+    uint16_t index;    // Opcode table index (0x100-0x1FF for CB-prefixed opcodes)
+    uint8_t imm[2];    // Pre-extracted immediate operand bytes
+    uint8_t length;    // Instruction length in bytes, including any CB prefix
+    uint8_t cycles;    // Static cycle count (conditional branches not taken)
+} MicroOp;
+
+// A run of instructions ending at a branch, keyed by start PC and ROM bank
+typedef struct Block {
+    uint16_t pc;
+    uint16_t bank;
+    uint32_t gen; // Memory code_gen of the block's page at decode time
+    uint8_t page;
+    uint8_t count; // Number of decoded ops, 0 if the slot is empty
+    MicroOp ops[BLOCK_MAX_OPS];
+
+    // Idle loop state: cycles per iteration if the block only polls memory and branches
+    // back to itself, 0 otherwise, the kinds of memory (IDLE_POLL_*) it reads at fixed
+    // addresses and the register pairs (IDLE_ADDR_*) it reads memory through
+    uint16_t idle_cycles;
+    uint8_t idle_polls;
+    uint8_t idle_addr_regs;
+
+    // Native code state, used by the JIT
+    uint16_t hits;
+    uint32_t native_epoch;
+    void *native;
+} Block;
+
+// Kinds of memory polled by idle loops, by what can change them
+#define IDLE_POLL_IO 0x01    // I/O registers, changed at PPU mode changes and scheduled events
+#define IDLE_POLL_LY 0x02    // LY, changed once per line
+#define IDLE_POLL_TIMER 0x04 // DIV and TIMA, changed continuously
+
+// Return the IDLE_POLL_* kind of [addr], or 0 for memory only the CPU writes.
+static inline uint8_t idle_poll_kind(uint16_t addr) {
+    if (addr <= 0xFF00 || addr >= 0xFF80) {
+        return 0;
+    }
+    if (addr == 0xFF44) {
+        return IDLE_POLL_LY;
+    }
+    if (addr == 0xFF04 || addr == 0xFF05) {
+        return IDLE_POLL_TIMER;
+    }
+    return IDLE_POLL_IO;
+}
+
+// Register pairs used as addresses by idle loops
+#define IDLE_ADDR_BC 0x01
+#define IDLE_ADDR_DE 0x02
+#define IDLE_ADDR_HL 0x04
+#define IDLE_ADDR_C 0x08 // FF00 + C
+
+typedef struct BlockCache {
+    Block blocks[BLOCK_CACHE_SIZE];
+
+    // Block currently being executed and the position of the next op in it
+    Block *current;
+    uint16_t next_pc;
+    uint8_t next_op;
+
+    // Holds instructions fetched outside the cache
+    MicroOp uncached;
+} BlockCache;
+
+// Initialization
+
+void block_cache_init(BlockCache *cache);
+
+// Lookup
+
+const MicroOp *block_lookup(CPU *cpu, Memory *mem);
+Block *block_enter(CPU *cpu, Memory *mem);
+
+#endif
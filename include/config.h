@@ -10,6 +10,11 @@ This file declares constants used by the system.
 #define SCREEN_WIDTH 160
 #define SCREEN_HEIGHT 144
 
+// Sprites
+
+#define OAM_SPRITES 40
+#define SPRITES_PER_LINE 10
+
 // Screen scale setting
 
 #define SCREEN_SCALING 3
@@ -31,22 +36,107 @@ This file declares constants used by the system.
 #define ROM_BANK_0_SIZE 0x4000   // 16 KB (0000 - 3FFF)
 #define ROM_BANK_N_SIZE 0x4000   // 16 KB (4000 - 7FFF)
 #define VRAM_SIZE 0x2000         // 8 KB (8000 - 9FFF)
+#define VRAM_TILES 384           // 16-byte tiles in 8000 - 97FF
 #define ERAM_SIZE 0x2000         // 8 KB (A000 - BFFF)
 #define WRAM_BANK_0_SIZE 0x1000  // 4 KB (C000 - CFFF)
 #define WRAM_BANK_1_SIZE 0x1000  // 4 KB (D000 - DFFF)
 #define OAM_SIZE 0x00A0          // 160 bytes (FE00 - FE9F)
 #define IO_REGISTERS_SIZE 0x0080 // 128 bytes (FF00–FF7F)
 #define HRAM_SIZE 0x007F         // 127 bytes (FF80–FFFE)
+#define ROM_MAX_SIZE 0x800000    // 8 MB, the MBC5 limit
 
 // Number of opcodes
 
 #define NUM_OPCODES 0x200 // 256 opcodes per table, for a total of 512
 
+// Instruction dispatch method
+// 0 = call handlers through opcode_table, 1 = threaded interpreter (computed goto, switch fallback)
+// Can also be selected at build time with `make DISPATCH=threaded`
+
+#ifndef CPU_THREADED_DISPATCH
+#define CPU_THREADED_DISPATCH 0
+#endif
+
+// Flag evaluation
+// 0 = compute flags in every ALU operation, 1 = record the last ALU operation and compute flags when read
+
+#ifndef CPU_LAZY_FLAGS
+#define CPU_LAZY_FLAGS 1
+#endif
+
+// Block cache settings
+
+#define BLOCK_CACHE_SIZE 256 // Number of cached blocks (power of 2)
+#define BLOCK_MAX_OPS 16     // Maximum instructions per block
+
+// Idle loop detection
+// 1 = skip iterations of loops that only poll memory until the next hardware event
+
+#ifndef IDLE_LOOP_SKIP
+#define IDLE_LOOP_SKIP 1
+#endif
+
+// Dynamic recompiler for x86-64 Linux hosts
+// Can also be enabled at build time with `make JIT=1`
+
+#ifndef CPU_JIT
+#define CPU_JIT 0
+#endif
+
+#define JIT_HOT_THRESHOLD 32      // Block executions before compiling
+#define JIT_BUFFER_SIZE 0x400000 // 4 MB of native code
+
+// Scanline pixel kernels for x86 hosts
+// 1 = pick SSE2 or AVX2 kernels at startup from what the CPU supports, 0 = scalar only
+
+#ifndef RENDER_SIMD
+#define RENDER_SIMD 1
+#endif
+
 // Frame timing constants
 
 #define CYCLES_PER_FRAME 70224
+#define CYCLES_PER_SECOND 4194304
 #define FRAME_TIME 0.016742706298828125 // 1.0 / 59.7275005696
 
+// Frame skipping: in turbo mode only one frame in TURBO_FRAME_SKIP is drawn and presented.
+// At normal speed, frames are skipped while the host is behind, at most MAX_FRAME_SKIP in a row
+
+#define TURBO_FRAME_SKIP 8
+#define MAX_FRAME_SKIP 4
+
+// Joypad and hotkey updates that can wait for the emulation thread, a power of two
+
+#define INPUT_QUEUE_SIZE 64
+
+// Serial transfer timing (internal clock, 8192 Hz)
+
+#define SERIAL_BIT_CYCLES 512
+
+// OAM DMA transfer time, 160 machine cycles
+
+#define DMA_CYCLES 640
+
+// Longest the timer is left without catching up while it cannot raise an interrupt
+
+#define TIMER_RESYNC_CYCLES 0x10000
+
+// ROM and save files are memory-mapped on POSIX hosts. Elsewhere, such as Windows,
+// the ROM is read into memory and saves are written back with stdio
+
+#ifndef HAVE_MMAP
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP 1
+#else
+#define HAVE_MMAP 0
+#endif
+#endif
+
+// Battery saves: dirty parts of the .sav mapping are written back this often, which
+// bounds what a system crash can lose
+
+#define SAVE_FLUSH_INTERVAL_MS 1000
+
 // Flag constants
 
 #define FLAG_Z 0x80
@@ -3,13 +3,39 @@
 
 #include <stdint.h>
 
+#include "block.h"
 #include "gb.h"
+#include "jit.h"
 #include "memory.h"
 #include "ppu.h"
 
 typedef struct Memory Memory;
 typedef struct PPU PPU;
 
+// Last flag-setting ALU operation, recorded for lazy flag evaluation
+typedef enum {
+    FLAG_OP_NONE = 0, // f is up to date
+    FLAG_OP_ADD,      // ADD/ADC: x + y + carry
+    FLAG_OP_SUB,      // SUB/SBC/CP: x - y - carry
+    FLAG_OP_AND,      // AND: result x
+    FLAG_OP_OR,       // OR/XOR: result x
+    FLAG_OP_INC,      // INC r: result x, carry holds the kept C flag
+    FLAG_OP_DEC,      // DEC r: result x, carry holds the kept C flag
+    FLAG_OP_ADD16     // ADD HL, rr: x + y, carry holds the kept Z flag
+} FlagOp;
+
+// Idle loop fast-forwarding state and statistics
+typedef struct IdleLoop {
+    Block *block;     // Idle loop whose start was the last block boundary, or NULL
+    int frame_cycles; // frame_cycles at that boundary
+    int bound;        // Cycles from that boundary until polled values can change
+
+    // Statistics
+    uint64_t detected;       // Idle loop blocks decoded
+    uint64_t skips;          // Fast-forwards taken
+    uint64_t skipped_cycles; // Cycles fast-forwarded
+} IdleLoop;
+
 typedef struct CPU {
 
     // 8-bit registers
@@ -26,6 +52,12 @@ typedef struct CPU {
     uint16_t pc;
     uint16_t sp;
 
+    // Lazy flags: f is only computed from these when read
+    uint8_t flag_op;    // FlagOp of the last ALU operation
+    uint8_t flag_carry; // Carry in, or flag bits kept by the operation
+    uint16_t flag_x;
+    uint16_t flag_y;
+
     // Interrupt handling
     uint8_t ime;
     uint8_t ime_delay;
@@ -40,6 +72,20 @@ typedef struct CPU {
     // Counter of cycles remaining for current frame
     int frame_cycles;
 
+    // Predecoded instruction blocks
+    BlockCache block_cache;
+
+    // Idle loop detection
+    IdleLoop idle;
+
+#if JIT_ENABLED
+    // Native code of hot blocks
+    Jit jit;
+#endif
+
+    // Immediate bytes of the current micro-op, or NULL to read them from memory
+    const uint8_t *imm;
+
     // Pointer to parent struct
     GB *gb;
 } CPU;
@@ -47,13 +93,142 @@ typedef struct CPU {
 // Initialization
 
 Status cpu_init(CPU *cpu, GB *gb);
+void cpu_close(CPU *cpu);
+
+// Flag operations
+
+// Compute the flags produced by the recorded ALU operation.
+static inline uint8_t eval_flags(CPU *cpu) {
+    unsigned x = cpu->flag_x;
+    unsigned y = cpu->flag_y;
+    unsigned carry = cpu->flag_carry;
+
+    switch (cpu->flag_op) {
+    case FLAG_OP_ADD:
+        return ((((x + y + carry) & 0xFF) == 0) ? FLAG_Z : 0) | (((x & 0x0F) + (y & 0x0F) + carry > 0x0F) ? FLAG_H : 0) |
+               ((x + y + carry > 0xFF) ? FLAG_C : 0);
+    case FLAG_OP_SUB:
+        return ((((x - y - carry) & 0xFF) == 0) ? FLAG_Z : 0) | FLAG_N | (((x & 0x0F) < (y & 0x0F) + carry) ? FLAG_H : 0) |
+               ((x < y + carry) ? FLAG_C : 0);
+    case FLAG_OP_AND:
+        return ((x == 0) ? FLAG_Z : 0) | FLAG_H;
+    case FLAG_OP_OR:
+        return (x == 0) ? FLAG_Z : 0;
+    case FLAG_OP_INC:
+        return ((x == 0) ? FLAG_Z : 0) | (((x & 0x0F) == 0) ? FLAG_H : 0) | carry;
+    case FLAG_OP_DEC:
+        return ((x == 0) ? FLAG_Z : 0) | FLAG_N | (((x & 0x0F) == 0x0F) ? FLAG_H : 0) | carry;
+    case FLAG_OP_ADD16:
+        return (((x & 0x0FFF) + (y & 0x0FFF) > 0x0FFF) ? FLAG_H : 0) | ((x + y > 0xFFFF) ? FLAG_C : 0) | carry;
+    default:
+        return cpu->f;
+    }
+}
+
+// Bring f up to date with the recorded ALU operation.
+static inline void sync_flags(CPU *cpu) {
+    if (cpu->flag_op != FLAG_OP_NONE) {
+        cpu->f = eval_flags(cpu);
+        cpu->flag_op = FLAG_OP_NONE;
+    }
+}
+
+// Return the up to date value of register f.
+static inline uint8_t get_f(CPU *cpu) {
+    sync_flags(cpu);
+    return cpu->f;
+}
+
+// Compute only the C flag of the recorded ALU operation, leaving the record pending.
+static inline uint8_t lazy_carry(CPU *cpu) {
+    unsigned x = cpu->flag_x;
+    unsigned y = cpu->flag_y;
+    unsigned carry = cpu->flag_carry;
+
+    switch (cpu->flag_op) {
+    case FLAG_OP_ADD:
+        return (x + y + carry > 0xFF) ? FLAG_C : 0;
+    case FLAG_OP_SUB:
+        return (x < y + carry) ? FLAG_C : 0;
+    case FLAG_OP_AND:
+    case FLAG_OP_OR:
+        return 0;
+    case FLAG_OP_INC:
+    case FLAG_OP_DEC:
+        return carry;
+    case FLAG_OP_ADD16:
+        return (x + y > 0xFFFF) ? FLAG_C : 0;
+    default:
+        return cpu->f & FLAG_C;
+    }
+}
+
+// Compute only the Z flag of the recorded ALU operation, leaving the record pending.
+static inline uint8_t lazy_zero(CPU *cpu) {
+    unsigned x = cpu->flag_x;
+    unsigned y = cpu->flag_y;
+    unsigned carry = cpu->flag_carry;
+
+    switch (cpu->flag_op) {
+    case FLAG_OP_ADD:
+        return (((x + y + carry) & 0xFF) == 0) ? FLAG_Z : 0;
+    case FLAG_OP_SUB:
+        return (((x - y - carry) & 0xFF) == 0) ? FLAG_Z : 0;
+    case FLAG_OP_AND:
+    case FLAG_OP_OR:
+    case FLAG_OP_INC:
+    case FLAG_OP_DEC:
+        return (x == 0) ? FLAG_Z : 0;
+    case FLAG_OP_ADD16:
+        return carry;
+    default:
+        return cpu->f & FLAG_Z;
+    }
+}
+
+// Record an ALU operation whose flags are computed when next read.
+// With CPU_LAZY_FLAGS disabled, the flags are computed immediately.
+static inline void record_flags(CPU *cpu, FlagOp op, uint16_t x, uint16_t y, uint8_t carry) {
+    cpu->flag_op = op;
+    cpu->flag_x = x;
+    cpu->flag_y = y;
+    cpu->flag_carry = carry;
+#if !CPU_LAZY_FLAGS
+    sync_flags(cpu);
+#endif
+}
+
+// Set all four flags at once.
+static inline void set_flags(CPU *cpu, uint8_t z, uint8_t n, uint8_t h, uint8_t c) {
+    cpu->f = (z ? FLAG_Z : 0) | (n ? FLAG_N : 0) | (h ? FLAG_H : 0) | (c ? FLAG_C : 0);
+    cpu->flag_op = FLAG_OP_NONE;
+}
+
+// Set the flag [flag] to [val].
+static inline void set_flag(CPU *cpu, uint8_t flag, uint8_t val) {
+    sync_flags(cpu);
+    cpu->f = (cpu->f & ~flag) | (-(val != 0) & flag);
+}
+
+// Return the flag [flag]. Z and C, the ones branches test, are read without bringing
+// f up to date.
+static inline uint8_t get_flag(CPU *cpu, uint8_t flag) {
+    switch (flag) {
+    case FLAG_Z:
+        return lazy_zero(cpu) != 0;
+    case FLAG_C:
+        return lazy_carry(cpu) != 0;
+    default:
+        return (get_f(cpu) & flag) != 0;
+    }
+}
 
 // Register pair operations
 // (read/write/arithmetic on 16-bit register pairs)
 
 // Return the value of register pair af.
 static inline uint16_t get_af(CPU *cpu) {
-    return (cpu->a << 8) | (cpu->f & 0xF0);
+    return (cpu->a << 8) | (get_f(cpu) & 0xF0);
 }
 
 // Return the value of register pair bc.
@@ -75,6 +250,7 @@ static inline uint16_t get_hl(CPU *cpu) {
 static inline void set_af(CPU *cpu, uint16_t val) {
     cpu->a = (val >> 8) & 0xFF;
     cpu->f = val & 0xF0;
+    cpu->flag_op = FLAG_OP_NONE;
 }
 
 // Set the value of register pair bc to [val].
@@ -109,18 +285,6 @@ static inline uint16_t get_hl_plus(CPU *cpu) {
     return value;
 }
 
-// Flag operations
-
-// Set the flag [flag] to [val].
-static inline void set_flag(CPU *cpu, uint8_t flag, uint8_t val) {
-    cpu->f = (cpu->f & ~flag) | (-(val != 0) & flag);
-}
-
-// Return the flag [flag].
-static inline uint8_t get_flag(CPU *cpu, uint8_t flag) {
-    return (cpu->f & flag) != 0;
-}
-
 // Operand accessors
 
 // Return the next opcode to execute and increments the PC by 1.
@@ -130,13 +294,17 @@ static inline uint8_t get_opcode(CPU *cpu, Memory *mem) {
 
 // Return the immediate 8-bit operand and increment the PC by 1.
 static inline uint8_t get_imm8(CPU *cpu, Memory *mem) {
+    if (cpu->imm) {
+        cpu->pc++;
+        return *cpu->imm++;
+    }
     return mem_read8(mem, cpu->pc++);
 }
 
 // Return the immediate 16-bit operand and increment the PC by 2.
 static inline uint16_t get_imm16(CPU *cpu, Memory *mem) {
-    uint8_t low = mem_read8(mem, cpu->pc++);
-    uint8_t high = mem_read8(mem, cpu->pc++);
+    uint8_t low = get_imm8(cpu, mem);
+    uint8_t high = get_imm8(cpu, mem);
     return (high << 8) | low;
 }
 
@@ -144,10 +312,105 @@ static inline uint16_t get_imm16(CPU *cpu, Memory *mem) {
 
 void cpu_handle_interrupts(CPU *cpu, Memory *mem);
 void cpu_step(CPU *cpu, Memory *mem);
+void cpu_run(CPU *cpu, Memory *mem);
 void tick(CPU *cpu, int cycles);
+int cpu_cycles_to_interrupt(CPU *cpu, Memory *mem);
+int cpu_halt_cycles(CPU *cpu, Memory *mem);
+int cpu_skip_idle_loop(CPU *cpu, Memory *mem, Block *block);
+
+// Instruction boundary helpers
+// (shared by cpu_step and the threaded interpreter)
+
+// Return nonzero if cpu_handle_interrupts would service an interrupt.
+static inline uint8_t cpu_interrupt_pending(CPU *cpu, Memory *mem) {
+    return cpu->ime && (mem_read_ie(mem) & mem_read_if(mem));
+}
+
+// Fetch the next opcode through memory, applying the HALT bug.
+static inline const MicroOp *cpu_fetch_uncached(CPU *cpu, Memory *mem) {
+    BlockCache *cache = &cpu->block_cache;
+    uint8_t op = mem_read8(mem, cpu->pc);
+
+    // Check for halt bug behaviour
+    if (!cpu->halt_bug) {
+        cpu->pc++;
+    } else {
+        cpu->halt_bug = 0;
+    }
+
+    cpu->imm = NULL;
+    cache->current = NULL;
+    cache->uncached.index = (op == 0xCB) ? 0x100 + get_opcode(cpu, mem) : op;
+    cache->uncached.handler = opcode_table[cache->uncached.index];
+    return &cache->uncached;
+}
+
+// Fetch the next instruction and return it as a micro-op. Code in ROM, WRAM and HRAM
+// comes from the block cache with its immediates already extracted.
+// CB-prefixed opcodes are mapped to indices 0x100-0x1FF.
+static inline const MicroOp *cpu_fetch(CPU *cpu, Memory *mem) {
+    BlockCache *cache = &cpu->block_cache;
+    Block *block = cache->current;
+    const MicroOp *uop;
+
+    if (cpu->halt_bug) {
+        return cpu_fetch_uncached(cpu, mem);
+    }
+
+    // Continue through the current block while execution follows it and its page is unchanged
+    if (block && cpu->pc == cache->next_pc && cache->next_op < block->count && block->gen == mem->code_gen[block->page]) {
+        uop = &block->ops[cache->next_op++];
+    } else {
+        uop = block_lookup(cpu, mem);
+        if (!uop) {
+            return cpu_fetch_uncached(cpu, mem);
+        }
+    }
+
+    cache->next_pc = cpu->pc + uop->length;
+    cpu->pc += (uop->index >= 0x100) ? 2 : 1;
+    cpu->imm = uop->imm;
+    return uop;
+}
+
+// At the start of a block, fast-forward idle loops and run hot blocks as native code.
+// Return 1 if cycles were used, in which case the caller restarts at the instruction boundary.
+static inline int cpu_block_boundary(CPU *cpu, Memory *mem) {
+#if IDLE_LOOP_SKIP || JIT_ENABLED
+    Block *block = block_enter(cpu, mem);
+    if (!block) {
+        return 0;
+    }
+#if IDLE_LOOP_SKIP
+    if (block->idle_cycles && cpu_skip_idle_loop(cpu, mem, block)) {
+        return 1;
+    }
+#endif
+#if JIT_ENABLED
+    if (jit_run(cpu, mem, block)) {
+        return 1;
+    }
+#endif
+#else
+    (void)cpu;
+    (void)mem;
+#endif
+    return 0;
+}
+
+// Set ime to 1 if ime_delay reaches 1, decrement counter otherwise
+static inline void check_ei_delay(CPU *cpu) {
+    if (cpu->ime_delay > 0) {
+        cpu->ime_delay--;
+        if (cpu->ime_delay == 0) {
+            cpu->ime = 1;
+        }
+    }
+}
 
 // Debug
 
 void print_cpu_state(CPU *cpu, Memory *mem);
+void cpu_report_idle(CPU *cpu);
 
 #endif
\ No newline at end of file
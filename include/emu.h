@@ -0,0 +1,57 @@
+#ifndef EMU_H
+#define EMU_H
+
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "gb.h"
+
+// Updates sent from the main thread to the emulation thread
+typedef enum {
+    INPUT_JOYPAD = 0, // New joypad state, active low as in gb->joypad_state
+    INPUT_TURBO,      // Toggle turbo mode
+    INPUT_PAUSE       // Toggle pause
+} InputType;
+
+typedef struct InputEvent {
+    uint8_t type;  // InputType
+    uint8_t value;
+} InputEvent;
+
+// Single-producer single-consumer ring of input events: only the main thread moves
+// head and only the emulation thread moves tail
+typedef struct InputQueue {
+    InputEvent events[INPUT_QUEUE_SIZE];
+    SDL_atomic_t head; // Next slot written
+    SDL_atomic_t tail; // Next slot read
+} InputQueue;
+
+typedef struct Emu {
+    GB *gb;
+
+    // Emulation thread, NULL while stopped
+    SDL_Thread *thread;
+    SDL_atomic_t running; // Cleared to ask the thread to return
+
+    // Frames emulated since the main thread last collected the count, for the FPS counter
+    SDL_atomic_t frames;
+
+    InputQueue input;
+} Emu;
+
+// Initialization
+
+void emu_init(Emu *emu, GB *gb);
+
+// Thread control. The main thread may only touch emulator state while it is stopped.
+
+Status emu_start(Emu *emu);
+void emu_stop(Emu *emu);
+
+// Input
+
+bool emu_send_input(Emu *emu, InputType type, uint8_t value);
+
+#endif
@@ -2,6 +2,7 @@
 #define GB_H
 
 #include "config.h"
+#include "scheduler.h"
 #include <stdint.h>
 
 // Forward declarations of components
@@ -15,6 +16,9 @@ typedef struct GB {
     PPU *ppu;
     Memory *mem;
 
+    // Master clock and pending hardware events
+    Scheduler scheduler;
+
     // State
     uint8_t joypad_state;
     int turbo;
@@ -0,0 +1,23 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include "config.h"
+#include "gb.h"
+
+// Command line options of a headless run
+typedef struct HeadlessOptions {
+    long frames;            // Frames of emulated time to run, 0 to run until the dump is written
+    long dump_frame;        // Displayed frame to write out, counted from 0, or -1 for none
+    const char *dump_path;  // PPM file the frame is written to
+    const char *input_path; // Input movie, NULL for no input
+} HeadlessOptions;
+
+// Run the loaded ROM as fast as possible with no window, reading input from a movie file,
+// for the given number of frames or, without one, until the dump is written.
+//
+// A movie is a text file of lines "<frame> [buttons...]": from that frame on, the listed
+// buttons (right, left, up, down, a, b, select, start) are held and all others released.
+// Lines must be in frame order. Blank lines and lines starting with '#' are ignored.
+Status headless_run(GB *gb, const HeadlessOptions *opts);
+
+#endif
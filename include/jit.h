@@ -0,0 +1,50 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "config.h"
+
+typedef struct Block Block;
+typedef struct CPU CPU;
+typedef struct Memory Memory;
+
+// The recompiler emits x86-64 code and needs Linux for mmap and perf maps
+#if CPU_JIT && defined(__x86_64__) && defined(__linux__)
+#define JIT_ENABLED 1
+#else
+#define JIT_ENABLED 0
+#endif
+
+#if JIT_ENABLED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Native code of one CPU. Filling the buffer starts a new epoch, which discards all of
+// its code. Each instance has its own, so emulators on other threads never see the
+// buffer made writable under code they are running.
+typedef struct Jit {
+    uint8_t *buffer; // Code buffer, NULL until the first block turns hot
+    size_t used;
+    uint32_t epoch;
+    int failed; // The host cannot run native code
+
+    // Maps the AH value produced by LAHF (SF ZF - AF - PF - CF) to SM83 Z, H and C flags
+    uint8_t lahf_flags[0x100];
+
+    // perf map so that `perf` can attribute samples in native code
+    FILE *perf_map;
+} Jit;
+
+// Initialization
+
+void jit_init(Jit *jit);
+void jit_close(Jit *jit);
+
+// Execution
+
+int jit_run(CPU *cpu, Memory *mem, Block *block);
+
+#endif
+
+#endif
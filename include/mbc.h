@@ -0,0 +1,85 @@
+#ifndef MBC_H
+#define MBC_H
+
+#include <SDL2/SDL.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "config.h"
+
+typedef struct Memory Memory;
+
+// Memory bank controller types
+typedef enum {
+    MBC_NONE = 0, // ROM only, with 8 KB of RAM always enabled
+    MBC_1,
+    MBC_3,
+    MBC_5
+} MbcType;
+
+// MBC3 real-time clock registers: seconds, minutes, hours, day low, day high
+#define RTC_REGS 5
+
+// Clock footer appended to the save file: live and latched registers as 32-bit words,
+// then the 64-bit wall-clock time of the save, all little-endian
+#define RTC_SAVE_SIZE 48
+
+// Dirty bit of the clock footer, after one bit per RAM bank
+#define SAVE_DIRTY_CLOCK 16
+
+typedef struct Rtc {
+    uint8_t regs[RTC_REGS];    // Live counter as of base_cycle
+    uint8_t latched[RTC_REGS]; // Counter as of the last latch, as read by the CPU
+    uint64_t base_cycle;       // Master clock time regs were last brought up to
+    uint32_t subsecond;        // Cycles into the current second at base_cycle
+    uint8_t latch;             // Last value written to 6000–7FFF
+} Rtc;
+
+typedef struct Cartridge {
+    uint8_t *rom;       // Whole ROM image, read-only
+    uint32_t rom_banks; // Number of 16 KB ROM banks, a power of two
+    uint8_t rom_mapped; // rom is a shared mapping of the file rather than a heap copy
+    uint8_t *ram;       // Cartridge RAM, NULL if there is none, inside save_map if battery backed
+    uint32_t ram_banks; // Number of 8 KB RAM banks, a power of two
+
+    uint8_t type;    // MbcType, from the header
+    uint8_t battery; // RAM and RTC persist in the save file
+    uint8_t has_rtc;
+
+    // Save file next to the ROM, empty if there is none
+    char save_path[1024];
+
+    // Shared mapping of the save file holding battery RAM and the clock, NULL if none.
+    // Without mmap this is a heap copy written back to save_file.
+    uint8_t *save_map;
+    uint32_t save_size;
+#if !HAVE_MMAP
+    FILE *save_file;
+#endif
+    SDL_atomic_t dirty;        // Parts of the mapping written since the last flush
+    SDL_Thread *flush_thread;  // Writes dirty parts back every SAVE_FLUSH_INTERVAL_MS
+    SDL_sem *flush_stop;       // Posted to stop the flush thread
+
+    // MBC3 real-time clock, only brought up to date when latched, written or saved
+    Rtc rtc;
+
+    // Bank registers
+    uint8_t ram_enable;
+    uint16_t rom_bank; // MBC1: low 5 bits of the ROM bank, MBC3: 7-bit, MBC5: 9-bit ROM bank
+    uint8_t ram_bank;  // MBC1: 2-bit upper bank register, MBC3: RAM bank or RTC register, MBC5: RAM bank
+    uint8_t mode;      // MBC1 banking mode
+} Cartridge;
+
+// Initialization
+
+Status mbc_init(Memory *mem, uint8_t *rom, uint32_t rom_size, int rom_mapped, const char *rom_path);
+void mbc_reset(Memory *mem);
+void mbc_close(Memory *mem);
+
+// Banking
+
+uint8_t mbc_read(Memory *mem, uint16_t addr);
+void mbc_write(Memory *mem, uint16_t addr, uint8_t value);
+void mbc_map(Memory *mem);
+
+#endif
@@ -5,16 +5,17 @@
 
 #include "config.h"
 #include "gb.h"
+#include "mbc.h"
 #include "ppu.h"
 
 typedef struct CPU CPU;
 typedef struct PPU PPU;
 
 typedef struct Memory {
-    uint8_t rom0[ROM_BANK_0_SIZE];   // 0000–3FFF
-    uint8_t romN[ROM_BANK_N_SIZE];   // 4000–7FFF
+    uint8_t *rom0;                   // 0000–3FFF, bank in the ROM image
+    uint8_t *romN;                   // 4000–7FFF, bank in the ROM image
     uint8_t vram[VRAM_SIZE];         // 8000–9FFF
-    uint8_t eram[ERAM_SIZE];         // A000–BFFF
+    uint8_t *eram;                   // A000–BFFF, bank in cartridge RAM, NULL if disabled
     uint8_t wram0[WRAM_BANK_0_SIZE]; // C000–CFFF
     uint8_t wram1[WRAM_BANK_1_SIZE]; // D000–DFFF
     uint8_t oam[OAM_SIZE];           // FE00–FE9F
@@ -24,6 +25,31 @@ typedef struct Memory {
 
     uint16_t div_internal;
     uint8_t tima_reload_delay;
+    uint64_t timer_synced; // Master clock time DIV and TIMA were last brought up to
+
+    // Bits shifted out by the current serial transfer
+    uint8_t serial_bits;
+
+    // OAM DMA in progress. The CPU can then only reach FF00–FFFF, so the page table is
+    // emptied for the transfer and restored from saved_read_page and saved_write_page.
+    uint8_t dma_active;
+    uint8_t dma_source; // Source page, FF46
+
+    // Cartridge and the ROM banks mapped at 0000–3FFF and 4000–7FFF
+    Cartridge cart;
+    uint16_t rom0_bank;
+    uint16_t rom_bank;
+
+    // Page table: host pointers to each 256-byte page, or NULL where accesses have side
+    // effects and go through mem_read_slow/mem_write_slow
+    uint8_t *read_page[0x100];
+    uint8_t *write_page[0x100];
+    uint8_t *saved_read_page[0x100];
+    uint8_t *saved_write_page[0x100];
+
+    // Predecoded code tracking, per 256-byte page
+    uint8_t code_page[0x100]; // Set while a cached block lives in the page
+    uint32_t code_gen[0x100]; // Incremented when a page with cached blocks is written
 
     // Pointer to parent struct
     GB *gb;
@@ -36,13 +62,79 @@ Status mem_rom_load(Memory *mem, const char *filename);
 // Initialization
 
 Status mem_init(Memory *mem, GB *gb);
+void mem_map_init(Memory *mem);
+
+// Timer
+
+void mem_timer_update(Memory *mem, int cycles);
+void mem_timer_sync(Memory *mem);
+void mem_timer_schedule(Memory *mem);
+void mem_timer_event(Memory *mem);
+int mem_timer_cycles_to_irq(Memory *mem);
+
+// Serial
+
+void mem_serial_event(Memory *mem, uint64_t time);
+
+// OAM DMA
+
+void mem_dma_event(Memory *mem);
+
+// I/O register handlers, indexed by address - FF00. NULL means a plain load or store.
+
+typedef uint8_t (*io_read_fn)(Memory *mem, uint16_t addr);
+typedef void (*io_write_fn)(Memory *mem, uint16_t addr, uint8_t value);
+
+extern const io_read_fn io_read_table[IO_REGISTERS_SIZE];
+extern const io_write_fn io_write_table[IO_REGISTERS_SIZE];
 
 // -----------------
 // Memory read/write
 // -----------------
 
-// Read an 8-bit value from memory at [addr].
-static inline uint8_t mem_read8(Memory *mem, uint16_t addr) {
+// Return the host pointer to WRAM page [page] (C0–DF).
+static inline uint8_t *mem_wram_page(Memory *mem, uint8_t page) {
+    return (page < 0xD0) ? &mem->wram0[(page - 0xC0) << 8] : &mem->wram1[(page - 0xD0) << 8];
+}
+
+// Set the write pointer of WRAM page [page] (C0–DF) and of its echo, if it has one.
+static inline void mem_map_wram_write(Memory *mem, uint8_t page, uint8_t *ptr) {
+    mem->write_page[page] = ptr;
+    if (page < 0xDE) {
+        mem->write_page[page + 0x20] = ptr;
+    }
+}
+
+// Mark [page] as holding cached blocks. Writes to it then take the slow path,
+// which invalidates them.
+static inline void mem_watch_code(Memory *mem, uint8_t page) {
+    mem->code_page[page] = 1;
+    if (page >= 0xC0 && page < 0xE0) {
+        mem_map_wram_write(mem, page, NULL);
+    }
+}
+
+// Invalidate cached blocks in the page of [addr] after a write to it.
+static inline void mem_code_write(Memory *mem, uint16_t addr) {
+    uint8_t page = addr >> 8;
+    if (mem->code_page[page]) {
+        mem->code_page[page] = 0;
+        mem->code_gen[page]++;
+
+        // Writes to the page are fast again until code is cached in it
+        if (page >= 0xC0 && page < 0xE0) {
+            mem_map_wram_write(mem, page, mem_wram_page(mem, page));
+        }
+    }
+}
+
+// Read an 8-bit value from memory at [addr], for pages with no host pointer.
+static inline uint8_t mem_read_slow(Memory *mem, uint16_t addr) {
+
+    // OAM DMA holds the bus to everything below FF00
+    if (mem->dma_active && addr < 0xFF00) {
+        return 0xFF;
+    }
 
     // 0000–3FFF: ROM bank 0
     if (addr < 0x4000) {
@@ -59,9 +151,9 @@ static inline uint8_t mem_read8(Memory *mem, uint16_t addr) {
         return mem->vram[addr - 0x8000];
     }
 
-    // A000–BFFF: External RAM
+    // A000–BFFF: External RAM, or RTC registers and open bus from the bank controller
     else if (addr < 0xC000) {
-        return mem->eram[addr - 0xA000];
+        return mem->eram ? mem->eram[addr - 0xA000] : mbc_read(mem, addr);
     }
 
     // C000–CFFF: WRAM bank 0
@@ -97,25 +189,9 @@ static inline uint8_t mem_read8(Memory *mem, uint16_t addr) {
     // FF00–FF7F: I/O registers
     else if (addr < 0xFF80) {
 
-        if (addr == 0xFF00) {
-            uint8_t select = mem->io[0x00] & 0x30;
-            uint8_t result = 0xCF;
-
-            if (!(select & 0x10)) {
-                // D-pad selected
-                result &= (mem->gb->joypad_state & 0x0F) | 0xF0;
-            }
-            if (!(select & 0x20)) {
-                // Buttons selected
-                result &= ((mem->gb->joypad_state >> 4) & 0x0F) | 0xF0;
-            }
-
-            return result;
-        }
-
-        // Force bits 5-7 of IF to high
-        if (addr == 0xFF0F) {
-            return 0xE0 | mem->io[0x0F];
+        io_read_fn read = io_read_table[addr - 0xFF00];
+        if (read) {
+            return read(mem, addr);
         }
         return mem->io[addr - 0xFF00];
     }
@@ -131,41 +207,68 @@ static inline uint8_t mem_read8(Memory *mem, uint16_t addr) {
     }
 }
 
-// Write an 8-bit value [value] to memory at [addr].
-static inline void mem_write8(Memory *mem, uint16_t addr, uint8_t value) {
+// Read an 8-bit value from memory at [addr].
+static inline uint8_t mem_read8(Memory *mem, uint16_t addr) {
+    const uint8_t *page = mem->read_page[addr >> 8];
+    if (page) {
+        return page[addr & 0xFF];
+    }
 
-    // Ignore writes to ROM for now (TODO: Implement ROM bank switching)
-    if (addr < 0x8000) {
+    // HRAM shares its page with the I/O registers, but often holds the stack
+    if (addr >= 0xFF80 && addr < 0xFFFF) {
+        return mem->hram[addr - 0xFF80];
+    }
+    return mem_read_slow(mem, addr);
+}
+
+// Write an 8-bit value [value] to memory at [addr], for pages with no host pointer.
+static inline void mem_write_slow(Memory *mem, uint16_t addr, uint8_t value) {
+
+    // OAM DMA holds the bus to everything below FF00
+    if (mem->dma_active && addr < 0xFF00) {
         return;
     }
 
+    // Writes to ROM go to the memory bank controller
+    if (addr < 0x8000) {
+        mbc_write(mem, addr, value);
+    }
+
     // 8000–9FFF: VRAM
     else if (addr < 0xA000) {
+        ppu_sync(mem->gb->ppu, mem);
         mem->vram[addr - 0x8000] = value;
+        ppu_vram_written(mem->gb->ppu, addr);
     }
 
-    else if (addr < 0xC000) { // ERAM
-        mem->eram[addr - 0xA000] = value;
+    else if (addr < 0xC000) { // ERAM, battery backed or unmapped
+        mbc_write(mem, addr, value);
     }
 
     else if (addr < 0xD000) { // WRAM0
         mem->wram0[addr - 0xC000] = value;
+        mem_code_write(mem, addr);
     }
 
     else if (addr < 0xE000) { // WRAM1
         mem->wram1[addr - 0xD000] = value;
+        mem_code_write(mem, addr);
     }
 
     else if (addr < 0xF000) { // Echo WRAM0
         mem->wram0[addr - 0xE000] = value;
+        mem_code_write(mem, addr - 0x2000);
     }
 
     else if (addr < 0xFE00) { // Echo WRAM1
         mem->wram1[addr - 0xF000] = value;
+        mem_code_write(mem, addr - 0x2000);
     }
 
     else if (addr < 0xFEA0) { // OAM
+        ppu_sync(mem->gb->ppu, mem);
         mem->oam[addr - 0xFE00] = value;
+        ppu_oam_written(mem->gb->ppu);
     }
 
     else if (addr < 0xFF00) { // unusable
@@ -174,58 +277,17 @@ static inline void mem_write8(Memory *mem, uint16_t addr, uint8_t value) {
 
     else if (addr < 0xFF80) { // IO registers
 
-        // Only bits 4 and 5 are writable
-        if (addr == 0xFF00) {
-            mem->io[0x00] = (mem->io[0x00] & 0xCF) | (value & 0x30);
-            return;
-        }
-
-        // Writing to FF04 resets DIV
-        if (addr == 0xFF04) {
-            mem->div_internal = 0;
-            mem->io[0x04] = 0;
-            return;
-        }
-
-        // Prevent writes to IF from clearing bits 5-7
-        if (addr == 0xFF0F) {
-            mem->io[0x0F] = 0xE0 | value;
-            return;
-        }
-
-        // STAT register - only bits 3-6 are writable, bit 7 always reads 1
-        if (addr == 0xFF41) {
-            mem->io[0x41] = (mem->io[0x41] & 0x07) | (value & 0x78) | 0x80;
-            ppu_check_stat(mem->gb->ppu, mem);
-            return;
-        }
-
-        // Block writes to LY
-        if (addr == 0xFF44) {
-            return;
-        }
-
-        // LYC register - re-evaluate STAT interrupt
-        if (addr == 0xFF45) {
-            mem->io[0x45] = value;
-            ppu_check_stat(mem->gb->ppu, mem);
+        io_write_fn write = io_write_table[addr - 0xFF00];
+        if (write) {
+            write(mem, addr, value);
             return;
         }
-
-        // DMA transfer
-        if (addr == 0xFF46) {
-            uint16_t source = value * 0x100;
-            for (int i = 0; i < 0xA0; i++) {
-                mem->oam[i] = mem_read8(mem, source + i);
-            }
-            return;
-        }
-
         mem->io[addr - 0xFF00] = value;
     }
 
     else if (addr < 0xFFFF) { // HRAM
         mem->hram[addr - 0xFF80] = value;
+        mem_code_write(mem, addr);
     }
 
     else { // IE
@@ -233,6 +295,33 @@ static inline void mem_write8(Memory *mem, uint16_t addr, uint8_t value) {
     }
 }
 
+// Return the interrupt enable register (FFFF), bypassing the page table.
+static inline uint8_t mem_read_ie(Memory *mem) {
+    return mem->ie;
+}
+
+// Return the interrupt flag register (FF0F), bypassing the page table.
+static inline uint8_t mem_read_if(Memory *mem) {
+    return 0xE0 | mem->io[0x0F];
+}
+
+// Write an 8-bit value [value] to memory at [addr].
+static inline void mem_write8(Memory *mem, uint16_t addr, uint8_t value) {
+    uint8_t *page = mem->write_page[addr >> 8];
+    if (page) {
+        page[addr & 0xFF] = value;
+        return;
+    }
+
+    // HRAM shares its page with the I/O registers, but often holds the stack
+    if (addr >= 0xFF80 && addr < 0xFFFF) {
+        mem->hram[addr - 0xFF80] = value;
+        mem_code_write(mem, addr);
+        return;
+    }
+    mem_write_slow(mem, addr, value);
+}
+
 // Stack operations
 
 void push8(CPU *cpu, Memory *mem, uint8_t value);
@@ -240,8 +329,4 @@ void push16(CPU *cpu, Memory *mem, uint16_t value);
 uint8_t pop8(CPU *cpu, Memory *mem);
 uint16_t pop16(CPU *cpu, Memory *mem);
 
-// Timer
-
-void mem_timer_update(Memory *mem, int cycles);
-
 #endif
\ No newline at end of file
@@ -12,4 +12,9 @@ typedef uint8_t (*opcode_fn)(struct CPU *cpu, struct Memory *mem);
 // Function pointer table
 extern opcode_fn opcode_table[NUM_OPCODES];
 
+#if CPU_THREADED_DISPATCH
+// Threaded interpreter loop, runs until the frame cycle budget is used up
+void opcode_run_threaded(struct CPU *cpu, struct Memory *mem);
+#endif
+
 #endif
\ No newline at end of file
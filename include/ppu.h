@@ -10,6 +10,16 @@
 
 typedef struct Memory Memory;
 
+// Called on the emulation thread with each finished frame, which stays in the
+// framebuffer until the callback returns
+typedef void (*PresentCallback)(PPU *ppu, void *data);
+
+// Display palettes, RGBA
+extern const uint32_t palettes[NUM_PALETTES][6];
+
+// Set in the shared frame index while it holds a frame the presenter has not taken
+#define FRAME_FRESH 4
+
 typedef struct PPU {
 
     // Keep track of PPU location
@@ -18,6 +28,9 @@ typedef struct PPU {
     uint8_t ly;   // 0–153
     uint8_t mode; // 0 = HBlank, 1 = VBlank, 2 = OAM, 3 = VRAM
 
+    // Master clock time the PPU has been stepped up to
+    uint64_t synced;
+
     // STAT interrupt line state
     bool stat_irq_line;
 
@@ -25,13 +38,49 @@ typedef struct PPU {
     uint8_t window_line;
     uint8_t window_drawn;
 
-    // SDL components
+    // SDL components, NULL when running headless
     SDL_Window *window;
     SDL_Renderer *renderer;
     SDL_Texture *texture;
 
-    // Framebuffer
-    uint32_t framebuffer[160 * 144];
+    // Framebuffer of shades 0–3, after BGP/OBP and before the display palette, which
+    // is only applied when a frame is presented
+    uint8_t framebuffer[SCREEN_WIDTH * SCREEN_HEIGHT];
+
+    // Where finished frames go, ppu_publish unless replaced
+    PresentCallback present;
+    void *present_data;
+
+    // Finished frames, handed from the emulation thread to the main thread through a
+    // triple buffer. Each side owns one buffer and swaps it with the shared one, so
+    // neither ever waits and the presenter always gets the newest frame.
+    uint8_t frames[3][SCREEN_WIDTH * SCREEN_HEIGHT];
+    SDL_atomic_t frame_shared; // Index of the shared buffer, with FRAME_FRESH set until it is taken
+    int frame_back;            // Buffer the next frame is published in, owned by the emulation thread
+    int frame_front;           // Buffer being presented, owned by the main thread
+
+    // Decoded tile cache: the 2-bit colour index of every pixel of each tile in VRAM,
+    // as stored and X-flipped for sprites. A tile is decoded again on its next use
+    // after a write to its 16 bytes.
+    uint8_t tiles[VRAM_TILES][8][8];
+    uint8_t tiles_xflip[VRAM_TILES][8][8];
+    uint8_t tile_dirty[VRAM_TILES];
+
+    // Sprite index: the OAM entries on each line, at most 10 and in drawing priority
+    // order (X, then OAM position). Rebuilt on the next line drawn after OAM changes.
+    uint8_t line_sprites[SCREEN_HEIGHT][SPRITES_PER_LINE];
+    uint8_t line_sprite_count[SCREEN_HEIGHT];
+    uint8_t sprite_height; // Sprite height the index was built for
+    uint8_t sprites_dirty;
+
+    // Background / window colour indices of the line being drawn, for sprite priority
+    uint8_t bg_indices[SCREEN_WIDTH];
+
+    // Frame skipping: skip_next is requested by the frontend and taken up at the start of
+    // the next frame, so a frame is always drawn whole or not at all. A skipped frame keeps
+    // exact timing and interrupts but is neither drawn nor presented.
+    uint8_t skip_next;
+    uint8_t skip_frame;
 
     // Active palette ID
     uint8_t palette_id;
@@ -41,34 +90,52 @@ typedef struct PPU {
 
 } PPU;
 
-typedef struct Sprite {
-
-    // Index of sprite in OAM
-    uint8_t index;
-
-    // X and Y position on screen
-    int y;
-    int x;
-
-    // Address of tile in OAM
-    uint16_t tile;
-
-    // Attribute bits
-    uint8_t attr;
-} Sprite;
-
 // Initialization
 
 Status ppu_init(PPU *ppu, GB *gb);
+Status ppu_open_window(PPU *ppu);
 void ppu_reset(PPU *ppu);
 
 // Execution
 
 void ppu_step(PPU *ppu, Memory *mem, int cycles);
 void ppu_check_stat(PPU *ppu, Memory *mem);
-
-// Miscellaneous
-
+int ppu_cycles_to_event(PPU *ppu, Memory *mem);
+int ppu_cycles_to_line(PPU *ppu, Memory *mem);
+
+// Synchronization
+
+void ppu_catch_up(PPU *ppu, Memory *mem);
+void ppu_schedule(PPU *ppu, Memory *mem);
+void ppu_event(PPU *ppu, Memory *mem);
+void ppu_write_register(PPU *ppu, Memory *mem, uint16_t addr, uint8_t value);
+
+// Bring the PPU up to the master clock. It runs behind the CPU until something can
+// observe it: an access to its registers, VRAM or OAM, its next event, or the end of a frame.
+static inline void ppu_sync(PPU *ppu, Memory *mem) {
+    if (ppu->synced != ppu->gb->scheduler.now) {
+        ppu_catch_up(ppu, mem);
+    }
+}
+
+// Mark the tile holding VRAM address [addr], if any, for decoding again after a write.
+static inline void ppu_vram_written(PPU *ppu, uint16_t addr) {
+    if (addr < 0x9800) {
+        ppu->tile_dirty[(addr - 0x8000) >> 4] = 1;
+    }
+}
+
+// Mark the sprite index for rebuilding after a write to OAM.
+static inline void ppu_oam_written(PPU *ppu) {
+    ppu->sprites_dirty = 1;
+}
+
+// Display
+
+void ppu_set_present(PPU *ppu, PresentCallback present, void *data);
+void ppu_publish(PPU *ppu, void *data);
+bool ppu_take_frame(PPU *ppu);
+void ppu_present(PPU *ppu);
 void ppu_palette_swap(PPU *ppu);
 
 #endif
\ No newline at end of file
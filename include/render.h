@@ -0,0 +1,35 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+// The vector kernels need x86 intrinsics and per-function target attributes
+#if RENDER_SIMD && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define RENDER_SIMD_ENABLED 1
+#else
+#define RENDER_SIMD_ENABLED 0
+#endif
+
+// Decode the 16 bytes of tile [data] into 2-bit colour indices, as stored and X-flipped.
+typedef void (*render_decode_fn)(const uint8_t *data, uint8_t tile[8][8], uint8_t tile_xflip[8][8]);
+
+// Expand [count] 2-bit colour indices into pixels through the 4-entry palette [colours].
+typedef void (*render_expand_fn)(uint32_t *out, const uint8_t *indices, const uint32_t *colours, int count);
+
+// Map [count] 2-bit colour indices to shades through the DMG palette register [palette].
+typedef void (*render_shade_fn)(uint8_t *out, const uint8_t *indices, uint8_t palette, int count);
+
+// Kernels in use, scalar until render_init picks faster ones
+
+extern render_decode_fn render_decode_tile;
+extern render_shade_fn render_shade;
+extern render_expand_fn render_expand;
+
+// Initialization
+
+void render_init(void);
+const char *render_kernel_name(void);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <limits.h>
+#include <stdint.h>
+
+#include "config.h"
+
+typedef struct GB GB;
+
+// Hardware events with a known time, one pending deadline per type
+typedef enum {
+    EVENT_TIMER = 0, // TIMA overflow interrupt, or a periodic timer resync while it is stopped
+    EVENT_SERIAL,    // Serial transfer bit shifted out
+    EVENT_PPU,       // PPU mode boundary at which it can request an interrupt
+    EVENT_DMA,       // OAM DMA transfer complete
+    NUM_EVENTS
+} EventType;
+
+#define EVENT_NEVER UINT64_MAX
+
+typedef struct Scheduler {
+    uint64_t now;                  // Master clock in cycles since power on
+    uint64_t next;                 // Earliest pending deadline, EVENT_NEVER if none
+    uint64_t deadline[NUM_EVENTS]; // Pending deadline per event type, EVENT_NEVER if none
+} Scheduler;
+
+// Initialization
+
+void scheduler_init(Scheduler *sched);
+
+// Event registration
+
+void scheduler_schedule(Scheduler *sched, EventType type, uint64_t time);
+void scheduler_cancel(Scheduler *sched, EventType type);
+
+// Dispatch
+
+void scheduler_dispatch(GB *gb);
+
+// Advance the master clock by [cycles] and run every event that has come due.
+static inline void scheduler_advance(GB *gb, Scheduler *sched, int cycles) {
+    sched->now += cycles;
+    if (sched->now >= sched->next) {
+        scheduler_dispatch(gb);
+    }
+}
+
+// Return the number of cycles until the event [type], or INT_MAX if it is not pending
+// or further away than that.
+static inline int scheduler_cycles_until(Scheduler *sched, EventType type) {
+    uint64_t deadline = sched->deadline[type];
+    if (deadline <= sched->now) {
+        return 0;
+    }
+    if (deadline == EVENT_NEVER || deadline - sched->now > INT_MAX) {
+        return INT_MAX;
+    }
+    return (int)(deadline - sched->now);
+}
+
+// Return the number of cycles until the next event of any type, or INT_MAX.
+static inline int scheduler_cycles_to_next(Scheduler *sched) {
+    if (sched->next <= sched->now) {
+        return 0;
+    }
+    if (sched->next == EVENT_NEVER || sched->next - sched->now > INT_MAX) {
+        return INT_MAX;
+    }
+    return (int)(sched->next - sched->now);
+}
+
+#endif
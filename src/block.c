@@ -0,0 +1,408 @@
+#include <string.h>
+
+#include "block.h"
+#include "cpu.h"
+#include "memory.h"
+
+// Instruction lengths in bytes, matching the operands each handler consumes
+static const uint8_t opcode_lengths[0x100] = {
+    1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1, // 0x
+    1, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 1x
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 2x
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 3x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 4x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 5x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 6x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 7x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 8x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 9x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // Ax
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // Bx
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1, // Cx
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1, // Dx
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1, // Ex
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1  // Fx
+};
+
+// Total instruction cycles, with conditional branches not taken
+static const uint8_t opcode_cycles[0x100] = {
+    4,  12, 8,  8,  4,  4,  8,  4,  20, 8,  8,  8,  4,  4,  8,  4,  // 0x
+    4,  12, 8,  8,  4,  4,  8,  4,  12, 8,  8,  8,  4,  4,  8,  4,  // 1x
+    8,  12, 8,  8,  4,  4,  8,  4,  8,  8,  8,  8,  4,  4,  8,  4,  // 2x
+    8,  12, 8,  8,  12, 12, 12, 4,  8,  8,  8,  8,  4,  4,  8,  4,  // 3x
+    4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,  // 4x
+    4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,  // 5x
+    4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,  // 6x
+    8,  8,  8,  8,  8,  8,  4,  8,  4,  4,  4,  4,  4,  4,  8,  4,  // 7x
+    4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,  // 8x
+    4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,  // 9x
+    4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,  // Ax
+    4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,  // Bx
+    8,  12, 12, 16, 12, 16, 8,  16, 8,  16, 12, 4,  12, 24, 8,  16, // Cx
+    8,  12, 12, 4,  12, 16, 8,  16, 8,  16, 12, 4,  12, 4,  8,  16, // Dx
+    12, 12, 8,  4,  4,  16, 8,  16, 16, 4,  16, 4,  4,  4,  8,  16, // Ex
+    12, 12, 8,  4,  4,  16, 8,  16, 12, 8,  16, 4,  4,  4,  8,  16  // Fx
+};
+
+/*
+block_ends
+
+Return true if [op] transfers control (jumps, calls, returns, RST) or halts,
+so that no further instructions belong in the same block.
+*/
+static inline int block_ends(uint8_t op) {
+    switch (op) {
+    case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // JR
+    case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: // JP
+    case 0xE9:                                             // JP HL
+    case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC: // CALL
+    case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8: // RET
+    case 0xD9:                                             // RETI
+    case 0xC7: case 0xCF: case 0xD7: case 0xDF:            // RST
+    case 0xE7: case 0xEF: case 0xF7: case 0xFF:            // RST
+    case 0x76:                                             // HALT
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Registers and flags tracked by the idle loop analysis
+#define IDLE_A 0x001
+#define IDLE_B 0x002
+#define IDLE_C 0x004
+#define IDLE_D 0x008
+#define IDLE_E 0x010
+#define IDLE_H 0x020
+#define IDLE_L 0x040
+#define IDLE_FZ 0x080
+#define IDLE_FN 0x100
+#define IDLE_FH 0x200
+#define IDLE_FC 0x400
+#define IDLE_FLAGS (IDLE_FZ | IDLE_FN | IDLE_FH | IDLE_FC)
+
+// Register for each operand encoding (B, C, D, E, H, L, (HL), A); (HL) reads H and L
+static const uint16_t idle_operands[8] = {IDLE_B, IDLE_C, IDLE_D, IDLE_E, IDLE_H, IDLE_L, IDLE_H | IDLE_L, IDLE_A};
+
+/*
+idle_op_effects
+
+Set [reads] and [writes] to the registers and flags read and written by [uop] and add
+any register pair it reads memory through to [addr_regs]. Return 0 if the instruction
+writes memory or has other side effects, so that it cannot be part of an idle loop.
+*/
+static int idle_op_effects(const MicroOp *uop, uint16_t *reads, uint16_t *writes, uint8_t *addr_regs) {
+    uint16_t op = uop->index;
+    *reads = 0;
+    *writes = 0;
+
+    // LD r, r'
+    if (op >= 0x40 && op < 0x80 && op != 0x76) {
+        if (((op >> 3) & 7) == 6) {
+            return 0;
+        }
+        if ((op & 7) == 6) {
+            *addr_regs |= IDLE_ADDR_HL;
+        }
+        *reads = idle_operands[op & 7];
+        *writes = idle_operands[(op >> 3) & 7];
+        return 1;
+    }
+
+    // ALU A, r / ALU A, d8
+    if ((op >= 0x80 && op < 0xC0) || (op >= 0xC0 && op < 0x100 && (op & 7) == 6)) {
+        int kind = (op >> 3) & 7;
+        if (op < 0xC0) {
+            if ((op & 7) == 6) {
+                *addr_regs |= IDLE_ADDR_HL;
+            }
+            *reads = idle_operands[op & 7];
+        }
+        *reads |= IDLE_A | ((kind == 1 || kind == 3) ? IDLE_FC : 0);
+        *writes = IDLE_FLAGS | ((kind == 7) ? 0 : IDLE_A);
+        return 1;
+    }
+
+    // BIT n, r
+    if (op >= 0x140 && op < 0x180) {
+        if ((op & 7) == 6) {
+            *addr_regs |= IDLE_ADDR_HL;
+        }
+        *reads = idle_operands[op & 7];
+        *writes = IDLE_FZ | IDLE_FN | IDLE_FH;
+        return 1;
+    }
+
+    switch (op) {
+    case 0x00: // NOP
+        return 1;
+
+    case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E: // LD r, d8
+        *writes = idle_operands[(op >> 3) & 7];
+        return 1;
+
+    case 0x0A: // LD A, (BC)
+        *addr_regs |= IDLE_ADDR_BC;
+        *reads = IDLE_B | IDLE_C;
+        *writes = IDLE_A;
+        return 1;
+
+    case 0x1A: // LD A, (DE)
+        *addr_regs |= IDLE_ADDR_DE;
+        *reads = IDLE_D | IDLE_E;
+        *writes = IDLE_A;
+        return 1;
+
+    case 0xF2: // LD A, (C)
+        *addr_regs |= IDLE_ADDR_C;
+        *reads = IDLE_C;
+        *writes = IDLE_A;
+        return 1;
+
+    case 0xF0: // LD A, (a8)
+    case 0xFA: // LD A, (a16)
+        *writes = IDLE_A;
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+/*
+block_idle_cycles
+
+Return the cycles taken by one iteration of [block] if it is an idle loop, or 0, and
+set [polls] and [addr_regs] to what it reads. An idle loop ends with a branch back to its own start, never writes memory, and
+every register it reads is either never written in the loop or written earlier in
+the same iteration. Each iteration then leaves the CPU in the same state as long as
+the memory it polls does not change, so iterations can be skipped until the next
+hardware event.
+*/
+static uint16_t block_idle_cycles(Block *block, uint8_t *polls, uint8_t *addr_regs) {
+    const MicroOp *branch = &block->ops[block->count - 1];
+    uint16_t op = branch->index;
+    uint16_t next = block->pc;
+    uint16_t branch_reads;
+    uint16_t cycles = 0;
+
+    *polls = 0;
+    *addr_regs = 0;
+
+    for (int i = 0; i < block->count - 1; i++) {
+        next += block->ops[i].length;
+    }
+
+    // Only JR/JP back to the block start, with the flag a conditional branch tests
+    if (op == 0x18 || op == 0xC3) {
+        branch_reads = 0;
+    } else if ((op & 0xE7) == 0x20 || (op & 0xE7) == 0xC2) {
+        branch_reads = (op & 0x10) ? IDLE_FC : IDLE_FZ;
+        cycles = 4; // Taken branches take 4 more cycles than opcode_cycles
+    } else {
+        return 0;
+    }
+
+    uint16_t target = (op < 0x40) ? (uint16_t)(next + branch->length + (int8_t)branch->imm[0])
+                                  : (uint16_t)(branch->imm[0] | (branch->imm[1] << 8));
+    if (target != block->pc) {
+        return 0;
+    }
+
+    uint16_t reads[BLOCK_MAX_OPS];
+    uint16_t writes[BLOCK_MAX_OPS];
+    uint16_t all_writes = 0;
+
+    for (int i = 0; i < block->count - 1; i++) {
+        const MicroOp *uop = &block->ops[i];
+
+        if (!idle_op_effects(uop, &reads[i], &writes[i], addr_regs)) {
+            return 0;
+        }
+
+        if (uop->index == 0xF0) {
+            *polls |= idle_poll_kind(0xFF00 | uop->imm[0]);
+        } else if (uop->index == 0xFA) {
+            *polls |= idle_poll_kind(uop->imm[0] | (uop->imm[1] << 8));
+        }
+
+        all_writes |= writes[i];
+        cycles += uop->cycles;
+    }
+    reads[block->count - 1] = branch_reads;
+    writes[block->count - 1] = 0;
+    cycles += branch->cycles;
+
+    if (*polls & IDLE_POLL_TIMER) {
+        return 0;
+    }
+
+    // Reject values carried over from the previous iteration
+    uint16_t written = 0;
+    for (int i = 0; i < block->count; i++) {
+        if (reads[i] & ~written & all_writes) {
+            return 0;
+        }
+        written |= writes[i];
+    }
+
+    return cycles;
+}
+
+/*
+block_region_end
+
+Return the first address past the cacheable region containing [pc], or 0 if code
+at [pc] must not be cached. ROM, WRAM and HRAM are cacheable; blocks never leave
+the 256-byte page they start in, so one page generation covers the whole block.
+*/
+static inline uint32_t block_region_end(uint16_t pc) {
+    if (pc < 0x8000 || (pc >= 0xC000 && pc < 0xE000)) {
+        return (pc & 0xFF00) + 0x100;
+    }
+    if (pc >= 0xFF80 && pc < 0xFFFF) {
+        return 0xFFFF;
+    }
+    return 0;
+}
+
+/*
+block_cache_init
+
+Empty the block cache.
+*/
+void block_cache_init(BlockCache *cache) {
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        cache->blocks[i].count = 0;
+    }
+    cache->current = NULL;
+    cache->next_pc = 0;
+    cache->next_op = 0;
+    memset(&cache->uncached, 0, sizeof(cache->uncached));
+}
+
+/*
+block_decode
+
+Decode instructions from [pc] into [block] until a branch, the end of the page,
+or BLOCK_MAX_OPS instructions.
+*/
+static void block_decode(Block *block, Memory *mem, uint16_t pc, uint16_t bank, uint32_t end) {
+    uint32_t addr = pc;
+
+    block->pc = pc;
+    block->bank = bank;
+    block->page = pc >> 8;
+    block->gen = mem->code_gen[block->page];
+    block->count = 0;
+    block->hits = 0;
+    block->native = NULL;
+
+    while (block->count < BLOCK_MAX_OPS) {
+        uint8_t op = mem_read8(mem, addr);
+        uint8_t length = opcode_lengths[op];
+
+        // Stop if the instruction does not fit in the region
+        if (addr + length > end) {
+            break;
+        }
+
+        MicroOp *uop = &block->ops[block->count++];
+
+        if (op == 0xCB) {
+            uint8_t cb = mem_read8(mem, addr + 1);
+            uop->index = 0x100 + cb;
+            uop->imm[0] = 0;
+            uop->imm[1] = 0;
+
+            // Register operands take 8 cycles, (HL) takes 16, or 12 for BIT
+            if ((cb & 0x07) != 0x06) {
+                uop->cycles = 8;
+            } else {
+                uop->cycles = ((cb & 0xC0) == 0x40) ? 12 : 16;
+            }
+        } else {
+            uop->index = op;
+            uop->imm[0] = (length > 1) ? mem_read8(mem, addr + 1) : 0;
+            uop->imm[1] = (length > 2) ? mem_read8(mem, addr + 2) : 0;
+            uop->cycles = opcode_cycles[op];
+        }
+
+        uop->handler = opcode_table[uop->index];
+        uop->length = length;
+        addr += length;
+
+        if (block_ends(op)) {
+            break;
+        }
+    }
+
+    block->idle_cycles = block->count ? block_idle_cycles(block, &block->idle_polls, &block->idle_addr_regs) : 0;
+}
+
+/*
+block_lookup
+
+Find or decode the block starting at the current PC and make it the current block.
+Return its first micro-op, or NULL if the code at PC is not cacheable.
+*/
+const MicroOp *block_lookup(CPU *cpu, Memory *mem) {
+    BlockCache *cache = &cpu->block_cache;
+    uint16_t pc = cpu->pc;
+
+    // During OAM DMA code outside HRAM is fetched through the bus, which reads 0xFF
+    uint32_t end = block_region_end(pc);
+    if (!end || (mem->dma_active && pc < 0xFF00)) {
+        cache->current = NULL;
+        return NULL;
+    }
+
+    uint16_t bank = (pc < 0x4000) ? mem->rom0_bank : (pc < 0x8000) ? mem->rom_bank : 0;
+    Block *block = &cache->blocks[(pc ^ (pc >> 8) ^ bank) & (BLOCK_CACHE_SIZE - 1)];
+
+    // Decode on a miss or if the page has been written since the block was decoded
+    if (!block->count || block->pc != pc || block->bank != bank || block->gen != mem->code_gen[block->page]) {
+        block_decode(block, mem, pc, bank, end);
+
+        // Watch RAM pages for writes
+        if (pc >= 0x8000) {
+            mem_watch_code(mem, block->page);
+        }
+
+        if (block->idle_cycles) {
+            cpu->idle.detected++;
+        }
+    }
+
+    if (!block->count) {
+        cache->current = NULL;
+        return NULL;
+    }
+
+    cache->current = block;
+    cache->next_op = 1;
+    return &block->ops[0];
+}
+
+/*
+block_enter
+
+Return the block starting at the current PC if execution is at a block boundary,
+leaving the cache so that the next fetch starts at the block's first op.
+Return NULL in the middle of a block or if the code at PC is not cacheable.
+*/
+Block *block_enter(CPU *cpu, Memory *mem) {
+    BlockCache *cache = &cpu->block_cache;
+
+    if (cpu->halt_bug || (cache->current && cpu->pc == cache->next_pc && cache->next_op < cache->current->count)) {
+        return NULL;
+    }
+
+    if (!block_lookup(cpu, mem)) {
+        return NULL;
+    }
+
+    cache->next_pc = cpu->pc;
+    cache->next_op = 0;
+    return cache->current;
+}
@@ -1,3 +1,4 @@
+#include <limits.h>
 #include <stdio.h>
 
 #include "cpu.h"
@@ -17,6 +18,7 @@ Status cpu_init(CPU *cpu, GB *gb) {
 
     cpu->a = 0x01;
     cpu->f = 0xB0;
+    cpu->flag_op = FLAG_OP_NONE;
     cpu->b = 0x00;
     cpu->c = 0x13;
     cpu->d = 0x00;
@@ -37,6 +39,14 @@ Status cpu_init(CPU *cpu, GB *gb) {
 
     cpu->frame_cycles = 0;
 
+    block_cache_init(&cpu->block_cache);
+    cpu->imm = NULL;
+
+    cpu->idle.block = NULL;
+    cpu->idle.detected = 0;
+    cpu->idle.skips = 0;
+    cpu->idle.skipped_cycles = 0;
+
     return OK;
 }
 
@@ -51,8 +61,8 @@ void cpu_handle_interrupts(CPU *cpu, Memory *mem) {
         return;
     }
 
-    uint8_t IE = mem_read8(mem, 0xFFFF); // Interrupt Enable
-    uint8_t IF = mem_read8(mem, 0xFF0F); // Interrupt Flag
+    uint8_t IE = mem_read_ie(mem); // Interrupt Enable
+    uint8_t IF = mem_read_if(mem); // Interrupt Flag
     uint8_t pending = IE & IF;
 
     if (!pending) {
@@ -92,37 +102,164 @@ void cpu_handle_interrupts(CPU *cpu, Memory *mem) {
     }
 }
 
-// Set ime to 1 if ime_delay reaches 1, decrement counter otherwise
-static inline void check_ei_delay(CPU *cpu) {
-    if (cpu->ime_delay > 0) {
-        cpu->ime_delay--;
-        if (cpu->ime_delay == 0) {
-            cpu->ime = 1;
-        }
+/*
+cpu_cycles_to_interrupt
+
+Return a lower bound on the number of cycles before an interrupt enabled in IE can
+become pending.
+*/
+int cpu_cycles_to_interrupt(CPU *cpu, Memory *mem) {
+    Scheduler *sched = &cpu->gb->scheduler;
+    uint8_t IE = mem_read_ie(mem);
+    int cycles = INT_MAX;
+
+    if (IE & 0x04) {
+        int timer = scheduler_cycles_until(sched, EVENT_TIMER);
+        cycles = (timer < cycles) ? timer : cycles;
+    }
+
+    if (IE & 0x08) {
+        int serial = scheduler_cycles_until(sched, EVENT_SERIAL);
+        cycles = (serial < cycles) ? serial : cycles;
     }
+
+    if (IE & 0x03) {
+        int ppu = scheduler_cycles_until(sched, EVENT_PPU);
+        cycles = (ppu < cycles) ? ppu : cycles;
+    }
+
+    return cycles;
 }
 
-// Request a serial interrupt if start bit is set.
-static inline void serial_check(Memory *mem) {
-    static int serial_count = 0;
+/*
+cpu_halt_cycles
 
-    if (mem->io[0x02] & 0x80) {
+Return the number of cycles a halted CPU can tick before it needs to check for
+interrupts again. The CPU polls every 4 cycles, so this is a whole number of polls
+that ends before an interrupt can become pending and does not run past the end of
+the frame; ticking them at once gives the same result as polling.
+*/
+int cpu_halt_cycles(CPU *cpu, Memory *mem) {
 
-        // Make a dummy transfer
-        mem->io[0x01] = (mem->io[0x01] << 1) | 1;
-        serial_count++;
+    // EI delay counts down once per poll
+    if (cpu->ime_delay) {
+        return 4;
+    }
 
-        if (serial_count >= 8) {
-            mem->io[0x02] &= ~0x80;
-            serial_count = 0;
+    int polls = (cpu_cycles_to_interrupt(cpu, mem) - 1) / 4;
+    int frame_polls = (cpu->frame_cycles + 3) / 4;
+    polls = (frame_polls < polls) ? frame_polls : polls;
 
-            if (mem->io[0x02] & 0x01) {
-                mem->io[0x0F] |= 0x08;
-            }
-        }
-    } else {
-        serial_count = 0;
+    return (polls > 1) ? polls * 4 : 4;
+}
+
+/*
+cpu_skip_idle_loop
+
+Called at the start of the idle loop [block]. If the previous iteration ran with no
+event since that could change the memory it polls or raise an interrupt, every
+iteration until the next such event leaves the CPU unchanged, so they are skipped
+in one tick. Return 1 if iterations were skipped.
+*/
+int cpu_skip_idle_loop(CPU *cpu, Memory *mem, Block *block) {
+    IdleLoop *idle = &cpu->idle;
+    int iteration = block->idle_cycles;
+    int elapsed = idle->frame_cycles - cpu->frame_cycles;
+    int last_bound = idle->bound;
+    int repeated = (idle->block == block && elapsed == iteration);
+
+    idle->block = NULL;
+
+    // EI delay advances per instruction, and memory outside HRAM reads differently
+    // once OAM DMA completes
+    if (cpu->ime_delay || mem->dma_active) {
+        return 0;
+    }
+
+    // Classify the addresses read through registers, which the loop never changes
+    uint8_t regs = block->idle_addr_regs;
+    uint8_t polls = block->idle_polls;
+    if (regs & IDLE_ADDR_BC) {
+        polls |= idle_poll_kind(get_bc(cpu));
+    }
+    if (regs & IDLE_ADDR_DE) {
+        polls |= idle_poll_kind(get_de(cpu));
+    }
+    if (regs & IDLE_ADDR_HL) {
+        polls |= idle_poll_kind(get_hl(cpu));
+    }
+    if (regs & IDLE_ADDR_C) {
+        polls |= idle_poll_kind(0xFF00 | cpu->c);
+    }
+    if (polls & IDLE_POLL_TIMER) {
+        return 0;
+    }
+
+    // RAM only changes in interrupt handlers, which also end the loop
+    int bound = cpu->ime ? cpu_cycles_to_interrupt(cpu, mem) : INT_MAX;
+
+    if (polls & IDLE_POLL_IO) {
+        int ppu = ppu_cycles_to_event(cpu->gb->ppu, mem);
+        int event = scheduler_cycles_to_next(&cpu->gb->scheduler);
+        bound = (ppu < bound) ? ppu : bound;
+        bound = (event < bound) ? event : bound;
+    }
+
+    if (polls & IDLE_POLL_LY) {
+        int line = ppu_cycles_to_line(cpu->gb->ppu, mem);
+        bound = (line < bound) ? line : bound;
     }
+
+    idle->block = block;
+    idle->frame_cycles = cpu->frame_cycles;
+    idle->bound = bound;
+
+    if (!repeated) {
+        return 0;
+    }
+
+    // The last iteration and all skipped ones must read memory before the event
+    int iterations = last_bound / iteration - 1;
+    int frame_iterations = cpu->frame_cycles / iteration;
+    iterations = (frame_iterations < iterations) ? frame_iterations : iterations;
+    if (iterations < 1) {
+        return 0;
+    }
+
+    int cycles = iterations * iteration;
+    tick(cpu, cycles);
+
+    idle->block = NULL;
+    idle->skips++;
+    idle->skipped_cycles += cycles;
+    return 1;
+}
+
+/*
+cpu_close
+
+Release the CPU's native code buffer, if the JIT is built in.
+*/
+void cpu_close(CPU *cpu) {
+#if JIT_ENABLED
+    jit_close(&cpu->jit);
+#else
+    (void)cpu;
+#endif
+}
+
+/*
+cpu_report_idle
+
+Print the idle loop fast-forwarding statistics, if it is built in.
+*/
+void cpu_report_idle(CPU *cpu) {
+#if IDLE_LOOP_SKIP
+    printf("Idle loops: %llu detected, %llu fast-forwards, %llu cycles skipped\n", (unsigned long long)cpu->idle.detected,
+           (unsigned long long)cpu->idle.skips, (unsigned long long)cpu->idle.skipped_cycles);
+#else
+    (void)cpu;
+#endif
 }
 
 /*
@@ -134,12 +271,12 @@ void cpu_step(CPU *cpu, Memory *mem) {
 
     // CPU halt logic
     if (cpu->halted) {
-        uint8_t IE = mem_read8(mem, 0xFFFF);
-        uint8_t IF = mem_read8(mem, 0xFF0F);
+        uint8_t IE = mem_read_ie(mem);
+        uint8_t IF = mem_read_if(mem);
         uint8_t pending = IE & IF;
 
         if (!pending) {
-            tick(cpu, 4);
+            tick(cpu, cpu_halt_cycles(cpu, mem));
             check_ei_delay(cpu);
             return;
         }
@@ -150,28 +287,20 @@ void cpu_step(CPU *cpu, Memory *mem) {
     // Check for interrupts
     cpu_handle_interrupts(cpu, mem);
 
-    // Fetch opcode
-    uint8_t op = mem_read8(mem, cpu->pc);
-
-    // Check for halt bug behaviour
-    if (!cpu->halt_bug) {
-        cpu->pc++;
-    } else {
-        cpu->halt_bug = 0;
+    // Fast-forward idle loops and run hot blocks as native code
+    if (cpu_block_boundary(cpu, mem)) {
+        return;
     }
 
-    // Run instruction handler
-    opcode_fn handler = opcode_table[(op == 0xCB) ? 0x100 + get_opcode(cpu, mem) : op];
-    uint8_t instruction_cycles = handler(cpu, mem);
+    // Fetch opcode and run instruction handler
+    const MicroOp *uop = cpu_fetch(cpu, mem);
+    uint8_t instruction_cycles = uop->handler(cpu, mem);
 
     tick(cpu, instruction_cycles);
 
     // Check EI delay after instruction completes
     check_ei_delay(cpu);
 
-    // Check for serial transfer
-    serial_check(mem);
-
     // DEBUG: print CPU state
     // WARNING: Uncommenting this line destroys performance
     // print_cpu_state(cpu, mem);
@@ -179,9 +308,35 @@ void cpu_step(CPU *cpu, Memory *mem) {
     return;
 }
 
+/*
+cpu_run
+
+Execute instructions until the frame cycle budget is used up, using the
+dispatch method selected by CPU_THREADED_DISPATCH.
+*/
+void cpu_run(CPU *cpu, Memory *mem) {
+    // Idle loop tracking relies on frame_cycles, which the caller has just reset
+    cpu->idle.block = NULL;
+
+#if CPU_THREADED_DISPATCH
+    opcode_run_threaded(cpu, mem);
+#else
+    while (cpu->frame_cycles > 0) {
+        cpu_step(cpu, mem);
+    }
+#endif
+
+    // Finish the frame's scanlines for presentation
+    ppu_sync(cpu->gb->ppu, mem);
+}
+
+/*
+tick
+
+Advance the master clock by [cycles], running any events that come due.
+*/
 void tick(CPU *cpu, int cycles) {
-    mem_timer_update(cpu->gb->mem, cycles);
-    ppu_step(cpu->gb->ppu, cpu->gb->mem, cycles);
+    scheduler_advance(cpu->gb, &cpu->gb->scheduler, cycles);
     cpu->frame_cycles -= cycles;
 }
 
@@ -190,6 +345,6 @@ Used for debugging
 */
 void print_cpu_state(CPU *cpu, Memory *mem) {
     printf("A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X\n",
-           cpu->a, cpu->f, cpu->b, cpu->c, cpu->d, cpu->e, cpu->h, cpu->l, cpu->sp, cpu->pc,
+           cpu->a, get_f(cpu), cpu->b, cpu->c, cpu->d, cpu->e, cpu->h, cpu->l, cpu->sp, cpu->pc,
            mem_read8(mem, cpu->pc), mem_read8(mem, cpu->pc + 1), mem_read8(mem, cpu->pc + 2), mem_read8(mem, cpu->pc + 3));
 }
\ No newline at end of file
@@ -0,0 +1,186 @@
+#include <stdio.h>
+
+#include "cpu.h"
+#include "emu.h"
+#include "memory.h"
+#include "ppu.h"
+
+/*
+emu_init
+
+Set up the emulation thread state for [gb], stopped and with no pending input.
+*/
+void emu_init(Emu *emu, GB *gb) {
+    emu->gb = gb;
+    emu->thread = NULL;
+    SDL_AtomicSet(&emu->running, 0);
+    SDL_AtomicSet(&emu->frames, 0);
+    SDL_AtomicSet(&emu->input.head, 0);
+    SDL_AtomicSet(&emu->input.tail, 0);
+}
+
+/*
+emu_apply_input
+
+Apply one input event to the emulator. Only the thread that owns the emulator
+state may call this.
+*/
+static void emu_apply_input(GB *gb, InputEvent event) {
+    switch (event.type) {
+    case INPUT_JOYPAD:
+        gb->joypad_state = event.value;
+        break;
+    case INPUT_TURBO:
+        gb->turbo ^= 1;
+        break;
+    case INPUT_PAUSE:
+        gb->paused ^= 1;
+        break;
+    }
+}
+
+/*
+emu_poll_input
+
+Apply every input event queued since the last poll, oldest first.
+*/
+static void emu_poll_input(Emu *emu) {
+    InputQueue *queue = &emu->input;
+
+    int tail = SDL_AtomicGet(&queue->tail);
+    int head = SDL_AtomicGet(&queue->head);
+    while (tail != head) {
+        emu_apply_input(emu->gb, queue->events[tail]);
+        tail = (tail + 1) & (INPUT_QUEUE_SIZE - 1);
+    }
+
+    // Release the slots to the main thread
+    SDL_AtomicSet(&queue->tail, tail);
+}
+
+/*
+emu_thread
+
+Run the emulator a frame at a time until asked to stop: take up queued input, run
+a frame's worth of cycles, then pace to ~59.7 FPS and pick the frames to skip.
+Finished frames leave through the PPU's triple buffer.
+*/
+static int emu_thread(void *data) {
+    Emu *emu = data;
+    GB *gb = emu->gb;
+
+    // Timing constants
+    uint64_t perf_freq = SDL_GetPerformanceFrequency();
+    double perf_freq_inv = 1.0 / (double) perf_freq; // Precalculate inverse of perf_freq to avoid doing extra division per frame
+    uint64_t start_counter = SDL_GetPerformanceCounter();
+    double next_frame_time = 0.0;
+
+    // Frame skipping
+    int turbo_frames = 0;
+    int skipped_frames = 0;
+
+    while (SDL_AtomicGet(&emu->running)) {
+        emu_poll_input(emu);
+
+        gb->cpu->frame_cycles = gb->paused ? 0 : CYCLES_PER_FRAME;
+        cpu_run(gb->cpu, gb->mem);
+        SDL_AtomicAdd(&emu->frames, 1);
+
+        // Limit performance to ~59.7 FPS when not in turbo mode
+        double now = (double)(SDL_GetPerformanceCounter() - start_counter) * perf_freq_inv;
+        int skip;
+        if (!gb->turbo) {
+            if (now < next_frame_time) {
+                double delay = next_frame_time - now;
+                SDL_Delay((uint32_t)(delay * 1000.0));
+            }
+            next_frame_time += FRAME_TIME;
+
+            // Skip the next frame if its deadline has already passed
+            skip = now > next_frame_time && skipped_frames < MAX_FRAME_SKIP;
+
+            // After a stall, carry on from now rather than running flat out through
+            // every missed frame
+            if (now - next_frame_time > MAX_FRAME_SKIP * FRAME_TIME) {
+                next_frame_time = now;
+            }
+        } else {
+            next_frame_time = now;
+
+            // Only draw one frame in TURBO_FRAME_SKIP
+            turbo_frames = (turbo_frames + 1) % TURBO_FRAME_SKIP;
+            skip = turbo_frames != 0;
+        }
+        skipped_frames = skip ? skipped_frames + 1 : 0;
+        gb->ppu->skip_next = skip;
+    }
+
+    return 0;
+}
+
+/*
+emu_start
+
+Start the emulation thread if it is not running. From here until emu_stop, the
+emulator state belongs to that thread.
+*/
+Status emu_start(Emu *emu) {
+    if (emu->thread) {
+        return OK;
+    }
+
+    SDL_AtomicSet(&emu->running, 1);
+    emu->thread = SDL_CreateThread(emu_thread, "emulation", emu);
+    if (!emu->thread) {
+        printf("Failed to start emulation thread: %s\n", SDL_GetError());
+        return ERR_SDL_NOT_INITIALIZED;
+    }
+
+    return OK;
+}
+
+/*
+emu_stop
+
+Stop the emulation thread at the end of its current frame and wait for it, then
+apply any input it did not take up. The emulator state is the caller's again after.
+*/
+void emu_stop(Emu *emu) {
+    if (!emu->thread) {
+        return;
+    }
+
+    SDL_AtomicSet(&emu->running, 0);
+    SDL_WaitThread(emu->thread, NULL);
+    emu->thread = NULL;
+
+    emu_poll_input(emu);
+}
+
+/*
+emu_send_input
+
+Queue an input event for the emulation thread, or apply it straight away while the
+thread is stopped. Return false if the queue is full and the event was dropped.
+Called on the main thread only.
+*/
+bool emu_send_input(Emu *emu, InputType type, uint8_t value) {
+    InputEvent event = {.type = type, .value = value};
+
+    if (!emu->thread) {
+        emu_apply_input(emu->gb, event);
+        return true;
+    }
+
+    InputQueue *queue = &emu->input;
+    int head = SDL_AtomicGet(&queue->head);
+    int next = (head + 1) & (INPUT_QUEUE_SIZE - 1);
+    if (next == SDL_AtomicGet(&queue->tail)) {
+        return false;
+    }
+
+    // Fill the slot before publishing it
+    queue->events[head] = event;
+    SDL_AtomicSet(&queue->head, next);
+    return true;
+}
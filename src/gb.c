@@ -16,6 +16,17 @@ Status GB_init(GB *gb, CPU *cpu, PPU *ppu, Memory *mem) {
     gb->ppu = ppu;
     gb->mem = mem;
 
+    // Components register their first events on initialization
+    scheduler_init(&gb->scheduler);
+
+    // Memory owns the cartridge buffers, which start out empty
+    memset(mem, 0, sizeof(*mem));
+
+#if JIT_ENABLED
+    // The CPU owns its native code buffer, which is only allocated once code turns hot
+    jit_init(&cpu->jit);
+#endif
+
     // Check for errors upon initialization
     status = cpu_init(cpu, gb);
     if (status != OK) {
@@ -60,14 +71,15 @@ Status GB_load_rom(GB *gb, const char *filepath) {
         return ERR_BAD_FILE;
     }
 
-    // Check file exists
-    FILE *test_file = fopen(filepath, "rb");
-    if (!test_file) {
-        printf("Error: Cannot open file: %s\n", filepath);
+    // Load ROM, which opens the file once and fails before anything is reset
+    status = mem_rom_load(gb->mem, filepath);
+    if (status != OK) {
+        if (status == ERR_FILE_NOT_FOUND) {
+            printf("Error: Cannot open file: %s\n", filepath);
+        }
         gb->rom_loaded = 0;
-        return ERR_FILE_NOT_FOUND;
+        return status;
     }
-    fclose(test_file);
 
     // Reset emulator state
     status = cpu_init(gb->cpu, gb);
@@ -84,13 +96,6 @@ Status GB_load_rom(GB *gb, const char *filepath) {
 
     ppu_reset(gb->ppu);
 
-    // Load ROM
-    status = mem_rom_load(gb->mem, filepath);
-    if (status != OK) {
-        gb->rom_loaded = 0;
-        return status;
-    }
-
     gb->rom_loaded = 1;
     return OK;
 }
\ No newline at end of file
@@ -0,0 +1,218 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "headless.h"
+#include "memory.h"
+#include "ppu.h"
+#include "render.h"
+
+// One line of an input movie: the joypad state from [frame] on
+typedef struct MovieEntry {
+    long frame;
+    uint8_t joypad; // Active low, as in gb->joypad_state
+} MovieEntry;
+
+typedef struct Headless {
+    const HeadlessOptions *opts;
+
+    MovieEntry *movie;
+    size_t movie_length;
+
+    long displayed; // Frames the PPU has finished
+    int dumped;     // The requested frame has been written
+    Status status;  // First error while writing it
+} Headless;
+
+/*
+headless_button
+
+Return the joypad bit of the button called [name], or 0 if there is none.
+*/
+static uint8_t headless_button(const char *name) {
+    static const char *buttons[8] = {"right", "left", "up", "down", "a", "b", "select", "start"};
+    for (int i = 0; i < 8; i++) {
+        if (strcmp(name, buttons[i]) == 0) {
+            return 1 << i;
+        }
+    }
+    return 0;
+}
+
+/*
+headless_load_movie
+
+Read the input movie at [path] into [hl]. Report the line of the first bad entry.
+*/
+static Status headless_load_movie(Headless *hl, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        printf("Error: Cannot open input movie: %s\n", path);
+        return ERR_FILE_NOT_FOUND;
+    }
+
+    size_t capacity = 0;
+    char line[256];
+    int line_number = 0;
+    Status status = OK;
+
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+
+        // Skip blank lines and comments
+        char *token = strtok(line, " \t\r\n");
+        if (!token || token[0] == '#') {
+            continue;
+        }
+
+        char *end;
+        long frame = strtol(token, &end, 10);
+        if (*end != '\0' || frame < 0 || (hl->movie_length && frame < hl->movie[hl->movie_length - 1].frame)) {
+            status = ERR_BAD_FILE;
+            break;
+        }
+
+        // Every button not listed is released
+        uint8_t joypad = 0xFF;
+        while ((token = strtok(NULL, " \t\r\n"))) {
+            for (char *c = token; *c; c++) {
+                *c = (char)tolower((unsigned char)*c);
+            }
+            uint8_t button = headless_button(token);
+            if (!button) {
+                status = ERR_BAD_FILE;
+                break;
+            }
+            joypad &= ~button;
+        }
+        if (status != OK) {
+            break;
+        }
+
+        if (hl->movie_length == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            MovieEntry *movie = realloc(hl->movie, capacity * sizeof(MovieEntry));
+            if (!movie) {
+                status = ERR_BAD_FILE;
+                break;
+            }
+            hl->movie = movie;
+        }
+        hl->movie[hl->movie_length].frame = frame;
+        hl->movie[hl->movie_length].joypad = joypad;
+        hl->movie_length++;
+    }
+
+    fclose(file);
+
+    if (status != OK) {
+        printf("Error: Bad input movie entry at %s:%d\n", path, line_number);
+    }
+    return status;
+}
+
+/*
+headless_write_ppm
+
+Write [frame] to [path] as a binary PPM in the colours of the active palette.
+*/
+static Status headless_write_ppm(PPU *ppu, const uint8_t *frame, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        printf("Error: Cannot create %s\n", path);
+        return ERR_BAD_FILE;
+    }
+
+    const uint32_t *colours = palettes[ppu->palette_id];
+    uint8_t row[SCREEN_WIDTH * 3];
+
+    fprintf(file, "P6\n%d %d\n255\n", SCREEN_WIDTH, SCREEN_HEIGHT);
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            uint32_t colour = colours[frame[y * SCREEN_WIDTH + x] & 3];
+            row[x * 3 + 0] = colour >> 24;
+            row[x * 3 + 1] = colour >> 16;
+            row[x * 3 + 2] = colour >> 8;
+        }
+        fwrite(row, sizeof(row), 1, file);
+    }
+
+    if (fclose(file) != 0) {
+        printf("Error: Cannot write %s\n", path);
+        return ERR_BAD_FILE;
+    }
+    return OK;
+}
+
+/*
+headless_present
+
+Presenter of a headless run: count finished frames and write out the requested one.
+*/
+static void headless_present(PPU *ppu, void *data) {
+    Headless *hl = data;
+
+    if (hl->displayed == hl->opts->dump_frame) {
+        hl->status = headless_write_ppm(ppu, ppu->framebuffer, hl->opts->dump_path);
+        hl->dumped = 1;
+    }
+    hl->displayed++;
+}
+
+/*
+headless_run
+
+Run a frame's worth of cycles at a time with no pacing, feeding in the movie's joypad
+state at the start of each frame, then report the speed reached and the pixel kernels
+it was reached with. The run needs a frame count or a frame to dump to know when to stop.
+*/
+Status headless_run(GB *gb, const HeadlessOptions *opts) {
+    Headless hl = {.opts = opts, .status = OK};
+
+    if (opts->frames <= 0 && opts->dump_frame < 0) {
+        printf("Error: A headless run needs a frame count or a frame to dump\n");
+        return ERR_BAD_ARGS;
+    }
+
+    if (opts->input_path) {
+        Status status = headless_load_movie(&hl, opts->input_path);
+        if (status != OK) {
+            free(hl.movie);
+            return status;
+        }
+    }
+
+    ppu_set_present(gb->ppu, headless_present, &hl);
+
+    uint64_t start_counter = SDL_GetPerformanceCounter();
+    size_t next_entry = 0;
+    long frame = 0;
+
+    while (opts->frames ? frame < opts->frames : !hl.dumped) {
+
+        // Apply the movie entries that start on this frame
+        while (next_entry < hl.movie_length && hl.movie[next_entry].frame <= frame) {
+            gb->joypad_state = hl.movie[next_entry].joypad;
+            next_entry++;
+        }
+
+        gb->cpu->frame_cycles = CYCLES_PER_FRAME;
+        cpu_run(gb->cpu, gb->mem);
+        frame++;
+    }
+
+    double elapsed = (double)(SDL_GetPerformanceCounter() - start_counter) / (double)SDL_GetPerformanceFrequency();
+    printf("Ran %ld frames (%ld displayed) in %.3f s, %.1f FPS with %s pixel kernels\n", frame, hl.displayed, elapsed,
+           elapsed > 0.0 ? frame / elapsed : 0.0, render_kernel_name());
+
+    ppu_set_present(gb->ppu, NULL, NULL);
+    free(hl.movie);
+
+    if (opts->dump_frame >= 0 && !hl.dumped) {
+        printf("Error: Frame %ld was never displayed, %s not written\n", opts->dump_frame, opts->dump_path);
+        return ERR_BAD_ARGS;
+    }
+    return hl.status;
+}
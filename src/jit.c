@@ -0,0 +1,732 @@
+// mmap, MAP_ANONYMOUS and getpid
+#define _DEFAULT_SOURCE
+
+#include "jit.h"
+
+#if JIT_ENABLED
+
+#include <cpuid.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "block.h"
+#include "cpu.h"
+#include "memory.h"
+
+// Native block entry point: runs until [budget] cycles would be exceeded or the
+// block ends, and returns the number of cycles executed
+typedef int (*jit_fn)(CPU *cpu, int budget);
+
+// x86-64 register numbers
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RSI 6
+#define RDI 7
+
+// Host registers holding the SM83 registers for the whole block
+#define HOST_A 8
+#define HOST_B 9
+#define HOST_C 10
+#define HOST_D 11
+#define HOST_E 12
+#define HOST_H 13
+#define HOST_L 14
+#define HOST_F 15
+
+// Host register for each SM83 register operand encoding (B, C, D, E, H, L, (HL), A)
+static const int host_regs[8] = {HOST_B, HOST_C, HOST_D, HOST_E, HOST_H, HOST_L, -1, HOST_A};
+
+typedef struct Emitter {
+    uint8_t *code;
+    size_t pos;
+    size_t cap;
+    int overflow;
+
+    // Positions of rel32 jumps to the block epilogue
+    size_t exits[BLOCK_MAX_OPS * 3 + 1];
+    int num_exits;
+} Emitter;
+
+/*
+================================
+   X86-64 ENCODING START
+================================
+*/
+
+static void emit8(Emitter *e, uint8_t byte) {
+    if (e->pos < e->cap) {
+        e->code[e->pos++] = byte;
+    } else {
+        e->overflow = 1;
+    }
+}
+
+static void emit32(Emitter *e, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        emit8(e, value >> (i * 8));
+    }
+}
+
+// REX prefix, always emitted so that byte registers 4-7 mean SPL-DIL rather than AH-BH
+static void emit_rex(Emitter *e, int reg, int rm) {
+    emit8(e, 0x40 | ((reg >> 3) << 2) | (rm >> 3));
+}
+
+// ModRM for a register-register operand
+static void emit_modrm(Emitter *e, int reg, int rm) {
+    emit8(e, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// ModRM for a [rdi + disp] operand, rdi holding the CPU pointer
+static void emit_modrm_cpu(Emitter *e, int reg, size_t disp) {
+    if (disp < 0x80) {
+        emit8(e, 0x40 | ((reg & 7) << 3) | RDI);
+        emit8(e, disp);
+    } else {
+        emit8(e, 0x80 | ((reg & 7) << 3) | RDI);
+        emit32(e, disp);
+    }
+}
+
+// <op> r/m8, r8 (op is the x86 opcode byte, e.g. 0x00 ADD, 0x88 MOV)
+static void emit_op_rr8(Emitter *e, uint8_t op, int dst, int src) {
+    emit_rex(e, src, dst);
+    emit8(e, op);
+    emit_modrm(e, src, dst);
+}
+
+// <group 1 op> r/m8, imm8 (digit: 0 ADD, 1 OR, 2 ADC, 3 SBB, 4 AND, 5 SUB, 6 XOR, 7 CMP)
+static void emit_op_ri8(Emitter *e, int digit, int dst, uint8_t imm) {
+    emit_rex(e, 0, dst);
+    emit8(e, 0x80);
+    emit_modrm(e, digit, dst);
+    emit8(e, imm);
+}
+
+// Single operand r/m8 instruction (FE /0 INC, FE /1 DEC, F6 /2 NOT)
+static void emit_unary8(Emitter *e, uint8_t op, int digit, int dst) {
+    emit_rex(e, 0, dst);
+    emit8(e, op);
+    emit_modrm(e, digit, dst);
+}
+
+// mov r8, imm8
+static void emit_mov_ri8(Emitter *e, int dst, uint8_t imm) {
+    emit_rex(e, 0, dst);
+    emit8(e, 0xB0 + (dst & 7));
+    emit8(e, imm);
+}
+
+// movzx r32, byte [rdi + disp]
+static void emit_load_cpu8(Emitter *e, int dst, size_t disp) {
+    emit_rex(e, dst, RDI);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit_modrm_cpu(e, dst, disp);
+}
+
+// mov byte [rdi + disp], r8
+static void emit_store_cpu8(Emitter *e, int src, size_t disp) {
+    emit_rex(e, src, RDI);
+    emit8(e, 0x88);
+    emit_modrm_cpu(e, src, disp);
+}
+
+// mov ecx, imm32
+static void emit_mov_ecx(Emitter *e, uint32_t imm) {
+    emit8(e, 0xB9);
+    emit32(e, imm);
+}
+
+// jmp rel32 to the epilogue, patched once the epilogue is placed
+static void emit_exit(Emitter *e, uint16_t pc) {
+    emit_mov_ecx(e, pc);
+    emit8(e, 0xE9);
+    e->exits[e->num_exits++] = e->pos;
+    emit32(e, 0);
+}
+
+// Stop with PC at [pc] unless at least [cycles] remain in the budget, then charge [cycles]
+static void emit_budget_check(Emitter *e, uint16_t pc, uint8_t cycles, uint8_t charge) {
+    // cmp ebx, cycles / jge +10
+    emit8(e, 0x81);
+    emit_modrm(e, 7, RBX);
+    emit32(e, cycles);
+    emit8(e, 0x7D);
+    emit8(e, 10);
+    emit_exit(e, pc);
+
+    // sub ebx, charge
+    emit8(e, 0x81);
+    emit_modrm(e, 5, RBX);
+    emit32(e, charge);
+}
+
+// Convert the x86 flags of the last arithmetic op to SM83 flags in AL (Z, H, C)
+static void emit_flags_to_al(Emitter *e) {
+    emit8(e, 0x9F); // lahf
+    emit8(e, 0x0F); // movzx eax, ah
+    emit8(e, 0xB6);
+    emit8(e, 0xC4);
+    emit8(e, 0x0F); // movzx eax, byte [rdx + rax]
+    emit8(e, 0xB6);
+    emit8(e, 0x04);
+    emit8(e, 0x02);
+}
+
+// Set the SM83 F register from the x86 flags after ADD/ADC/SUB/SBC/CP
+static void emit_alu_flags(Emitter *e, int subtract) {
+    emit_flags_to_al(e);
+    if (subtract) {
+        emit8(e, 0x0C); // or al, N
+        emit8(e, FLAG_N);
+    }
+    emit_op_rr8(e, 0x88, HOST_F, RAX);
+}
+
+// Set Z/N/H from the x86 flags after INC/DEC, keeping C
+static void emit_incdec_flags(Emitter *e, int subtract) {
+    emit_flags_to_al(e);
+    emit8(e, 0x24); // and al, Z | H
+    emit8(e, FLAG_Z | FLAG_H);
+    if (subtract) {
+        emit8(e, 0x0C); // or al, N
+        emit8(e, FLAG_N);
+    }
+    emit_op_ri8(e, 4, HOST_F, FLAG_C);
+    emit_op_rr8(e, 0x08, HOST_F, RAX);
+}
+
+// Set F to Z 0 [h] 0 from the x86 zero flag after AND/OR/XOR
+static void emit_logic_flags(Emitter *e, uint8_t h) {
+    emit8(e, 0x0F); // setz al
+    emit8(e, 0x94);
+    emit8(e, 0xC0);
+    emit8(e, 0xC0); // shl al, 7
+    emit8(e, 0xE0);
+    emit8(e, 0x07);
+    if (h) {
+        emit8(e, 0x0C); // or al, H
+        emit8(e, FLAG_H);
+    }
+    emit_op_rr8(e, 0x88, HOST_F, RAX);
+}
+
+// Load the SM83 carry flag into the x86 carry flag (bt r15d, 4)
+static void emit_carry_in(Emitter *e) {
+    emit_rex(e, 0, HOST_F);
+    emit8(e, 0x0F);
+    emit8(e, 0xBA);
+    emit_modrm(e, 4, HOST_F);
+    emit8(e, 4);
+}
+
+/*
+================================
+   BLOCK TRANSLATION START
+================================
+*/
+
+/*
+jit_emit_alu
+
+Emit ADD/ADC/SUB/SBC/AND/XOR/OR/CP of A with [src] (a host register) or, if [src]
+is negative, with [imm].
+*/
+static void jit_emit_alu(Emitter *e, int kind, int src, uint8_t imm) {
+    // x86 opcode byte (register form) and group 1 digit (immediate form) per SM83 ALU op
+    static const uint8_t rr_ops[8] = {0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38};
+    static const int ri_digits[8] = {0, 2, 5, 3, 4, 6, 1, 7};
+
+    if (kind == 1 || kind == 3) {
+        emit_carry_in(e);
+    }
+
+    if (src >= 0) {
+        emit_op_rr8(e, rr_ops[kind], HOST_A, src);
+    } else {
+        emit_op_ri8(e, ri_digits[kind], HOST_A, imm);
+    }
+
+    switch (kind) {
+    case 4:
+        emit_logic_flags(e, 1);
+        break;
+    case 5:
+    case 6:
+        emit_logic_flags(e, 0);
+        break;
+    default:
+        emit_alu_flags(e, kind == 2 || kind == 3 || kind == 7);
+        break;
+    }
+}
+
+/*
+jit_emit_pair
+
+Emit INC/DEC of a 16-bit register pair held in [high] and [low].
+*/
+static void jit_emit_pair(Emitter *e, int high, int low, int decrement) {
+    // movzx eax, high / shl eax, 8
+    emit_rex(e, RAX, high);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit_modrm(e, RAX, high);
+    emit8(e, 0xC1);
+    emit_modrm(e, 4, RAX);
+    emit8(e, 8);
+
+    // movzx ecx, low / or eax, ecx
+    emit_rex(e, RCX, low);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit_modrm(e, RCX, low);
+    emit8(e, 0x09);
+    emit_modrm(e, RCX, RAX);
+
+    // inc/dec eax
+    emit8(e, 0xFF);
+    emit_modrm(e, decrement ? 1 : 0, RAX);
+
+    // mov low, al / shr eax, 8 / mov high, al
+    emit_op_rr8(e, 0x88, low, RAX);
+    emit8(e, 0xC1);
+    emit_modrm(e, 5, RAX);
+    emit8(e, 8);
+    emit_op_rr8(e, 0x88, high, RAX);
+}
+
+/*
+jit_emit_op
+
+Emit native code for one register-only instruction. Return 0 if the instruction
+accesses memory or is otherwise not supported, ending the native part of the block.
+*/
+static int jit_emit_op(Emitter *e, const MicroOp *uop) {
+    uint16_t op = uop->index;
+
+    // LD r, r'
+    if (op >= 0x40 && op < 0x80) {
+        int dst = host_regs[(op >> 3) & 7];
+        int src = host_regs[op & 7];
+        if (dst < 0 || src < 0) {
+            return 0;
+        }
+        emit_op_rr8(e, 0x88, dst, src);
+        return 1;
+    }
+
+    // ALU A, r
+    if (op >= 0x80 && op < 0xC0) {
+        int src = host_regs[op & 7];
+        if (src < 0) {
+            return 0;
+        }
+        jit_emit_alu(e, (op >> 3) & 7, src, 0);
+        return 1;
+    }
+
+    // ALU A, d8
+    if (op >= 0xC0 && op < 0x100 && (op & 0x07) == 0x06) {
+        jit_emit_alu(e, (op >> 3) & 7, -1, uop->imm[0]);
+        return 1;
+    }
+
+    if (op < 0x40) {
+        int reg = host_regs[(op >> 3) & 7];
+
+        switch (op & 0x07) {
+        case 0x04: // INC r
+        case 0x05: // DEC r
+            if (reg < 0) {
+                return 0;
+            }
+            emit_unary8(e, 0xFE, op & 1, reg);
+            emit_incdec_flags(e, op & 1);
+            return 1;
+
+        case 0x06: // LD r, d8
+            if (reg < 0) {
+                return 0;
+            }
+            emit_mov_ri8(e, reg, uop->imm[0]);
+            return 1;
+
+        case 0x03: { // INC rr / DEC rr
+            int decrement = (op & 0x08) != 0;
+            switch (op >> 4) {
+            case 0:
+                jit_emit_pair(e, HOST_B, HOST_C, decrement);
+                return 1;
+            case 1:
+                jit_emit_pair(e, HOST_D, HOST_E, decrement);
+                return 1;
+            case 2:
+                jit_emit_pair(e, HOST_H, HOST_L, decrement);
+                return 1;
+            default:
+                // inc/dec word [rdi + sp]
+                emit8(e, 0x66);
+                emit8(e, 0xFF);
+                emit_modrm_cpu(e, decrement ? 1 : 0, offsetof(CPU, sp));
+                return 1;
+            }
+        }
+        }
+    }
+
+    switch (op) {
+    case 0x00: // NOP
+        return 1;
+
+    case 0x2F: // CPL
+        emit_unary8(e, 0xF6, 2, HOST_A);
+        emit_op_ri8(e, 1, HOST_F, FLAG_N | FLAG_H);
+        return 1;
+
+    case 0x37: // SCF
+        emit_op_ri8(e, 4, HOST_F, FLAG_Z);
+        emit_op_ri8(e, 1, HOST_F, FLAG_C);
+        return 1;
+
+    case 0x3F: // CCF
+        emit_op_ri8(e, 4, HOST_F, FLAG_Z | FLAG_C);
+        emit_op_ri8(e, 6, HOST_F, FLAG_C);
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+/*
+jit_emit_branch
+
+Emit JR/JP (conditional or not) ending the block at [pc]. Return 0 if [uop] is not
+a supported branch.
+*/
+static int jit_emit_branch(Emitter *e, const MicroOp *uop, uint16_t pc) {
+    uint16_t op = uop->index;
+    uint16_t next = pc + uop->length;
+    uint16_t target;
+    uint8_t not_taken;
+
+    // CB-prefixed opcodes share low bits with the branch encodings
+    if (op >= 0x100) {
+        return 0;
+    }
+
+    if (op == 0x18 || (op & 0xE7) == 0x20) {
+        target = next + (int8_t)uop->imm[0];
+        not_taken = 8;
+    } else if (op == 0xC3 || (op & 0xE7) == 0xC2) {
+        target = uop->imm[0] | (uop->imm[1] << 8);
+        not_taken = 12;
+    } else {
+        return 0;
+    }
+
+    emit_budget_check(e, pc, not_taken + 4, not_taken);
+
+    // Unconditional branch
+    if (op == 0x18 || op == 0xC3) {
+        emit8(e, 0x81); // sub ebx, 4
+        emit_modrm(e, 5, RBX);
+        emit32(e, 4);
+        emit_exit(e, target);
+        return 1;
+    }
+
+    // test F, flag, then skip the taken path if the condition fails
+    int cond = (op >> 3) & 3; // NZ, Z, NC, C
+    emit_rex(e, 0, HOST_F);
+    emit8(e, 0xF6);
+    emit_modrm(e, 0, HOST_F);
+    emit8(e, (cond < 2) ? FLAG_Z : FLAG_C);
+    emit8(e, (cond & 1) ? 0x74 : 0x75); // jz/jnz over the 16-byte taken path
+    emit8(e, 16);
+
+    emit8(e, 0x81); // sub ebx, 4
+    emit_modrm(e, 5, RBX);
+    emit32(e, 4);
+    emit_exit(e, target);
+
+    emit_exit(e, next);
+    return 1;
+}
+
+// SM83 register fields in the order the host registers are loaded and stored
+static const size_t reg_offsets[8] = {offsetof(CPU, a), offsetof(CPU, b), offsetof(CPU, c), offsetof(CPU, d),
+                                      offsetof(CPU, e), offsetof(CPU, h), offsetof(CPU, l), offsetof(CPU, f)};
+static const int reg_hosts[8] = {HOST_A, HOST_B, HOST_C, HOST_D, HOST_E, HOST_H, HOST_L, HOST_F};
+
+/*
+jit_compile
+
+Translate the longest supported prefix of [block] into native code in [jit]'s buffer.
+Return the entry point, or NULL if not even the first instruction is supported or the
+code did not fit in the rest of the buffer, in which case [full] is set. The buffer
+must be writable.
+*/
+static void *jit_compile(Jit *jit, Block *block, int *full) {
+    Emitter e = {.code = jit->buffer + jit->used, .pos = 0, .cap = JIT_BUFFER_SIZE - jit->used};
+    uint16_t pc = block->pc;
+    int compiled = 0;
+
+    *full = 0;
+
+    // Prologue: save callee-saved registers, budget into ebx, flag table into rdx
+    emit8(&e, 0x53);
+    for (int reg = 12; reg <= 15; reg++) {
+        emit8(&e, 0x41);
+        emit8(&e, 0x50 + (reg & 7));
+    }
+    emit8(&e, 0x89); // mov ebx, esi
+    emit_modrm(&e, RSI, RBX);
+    emit8(&e, 0x48); // mov rdx, lahf_flags
+    emit8(&e, 0xBA);
+    uint64_t table = (uint64_t)(uintptr_t)jit->lahf_flags;
+    emit32(&e, (uint32_t)table);
+    emit32(&e, (uint32_t)(table >> 32));
+    for (int i = 0; i < 8; i++) {
+        emit_load_cpu8(&e, reg_hosts[i], reg_offsets[i]);
+    }
+
+    int ended = 0;
+    for (int i = 0; i < block->count; i++) {
+        const MicroOp *uop = &block->ops[i];
+
+        if (jit_emit_branch(&e, uop, pc)) {
+            compiled++;
+            ended = 1;
+            break;
+        }
+
+        size_t start = e.pos;
+        int start_exits = e.num_exits;
+        emit_budget_check(&e, pc, uop->cycles, uop->cycles);
+        if (!jit_emit_op(&e, uop)) {
+            e.pos = start;
+            e.num_exits = start_exits;
+            break;
+        }
+
+        compiled++;
+        pc += uop->length;
+    }
+
+    if (!compiled) {
+        return NULL;
+    }
+
+    // Leave at the first instruction that was not translated
+    if (!ended) {
+        emit_exit(&e, pc);
+    }
+
+    // Epilogue: store PC (in cx) and registers, return the cycles used
+    size_t epilogue = e.pos;
+    emit8(&e, 0x66);
+    emit8(&e, 0x89);
+    emit_modrm_cpu(&e, RCX, offsetof(CPU, pc));
+    for (int i = 0; i < 8; i++) {
+        emit_store_cpu8(&e, reg_hosts[i], reg_offsets[i]);
+    }
+    emit8(&e, 0x89); // mov eax, esi
+    emit_modrm(&e, RSI, RAX);
+    emit8(&e, 0x29); // sub eax, ebx
+    emit_modrm(&e, RBX, RAX);
+    for (int reg = 15; reg >= 12; reg--) {
+        emit8(&e, 0x41);
+        emit8(&e, 0x58 + (reg & 7));
+    }
+    emit8(&e, 0x5B);
+    emit8(&e, 0xC3);
+
+    if (e.overflow) {
+        *full = 1;
+        return NULL;
+    }
+
+    for (int i = 0; i < e.num_exits; i++) {
+        int32_t rel = (int32_t)(epilogue - (e.exits[i] + 4));
+        for (int b = 0; b < 4; b++) {
+            e.code[e.exits[i] + b] = (uint8_t)(rel >> (b * 8));
+        }
+    }
+
+    void *entry = e.code;
+    jit->used += e.pos;
+
+    if (jit->perf_map) {
+        fprintf(jit->perf_map, "%lx %zx sm83_%02X_%04X\n", (unsigned long)(uintptr_t)entry, e.pos, block->bank,
+                block->pc);
+        fflush(jit->perf_map);
+    }
+
+    return entry;
+}
+
+/*
+jit_protect
+
+Make [jit]'s code buffer writable for emitting into, or executable to run it. It is
+never both at once, for hosts that refuse writable and executable mappings. Return 0
+if the host refuses the change.
+*/
+static int jit_protect(Jit *jit, int writable) {
+    return mprotect(jit->buffer, JIT_BUFFER_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+}
+
+/*
+jit_open
+
+Allocate [jit]'s code buffer and open the perf map. Return 0 if the host cannot run
+native code.
+*/
+static int jit_open(Jit *jit) {
+    unsigned int eax, ebx, ecx, edx;
+
+    // LAHF is optional in 64-bit mode
+    if (!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) || !(ecx & 1)) {
+        return 0;
+    }
+
+    uint8_t *buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        return 0;
+    }
+    jit->buffer = buffer;
+
+    // Find out now whether the buffer may be made executable at all
+    if (!jit_protect(jit, 0) || !jit_protect(jit, 1)) {
+        munmap(jit->buffer, JIT_BUFFER_SIZE);
+        jit->buffer = NULL;
+        return 0;
+    }
+
+    for (int ah = 0; ah < 0x100; ah++) {
+        jit->lahf_flags[ah] = ((ah & 0x40) ? FLAG_Z : 0) | ((ah & 0x10) ? FLAG_H : 0) | ((ah & 0x01) ? FLAG_C : 0);
+    }
+
+    // Instances in one process share the map, each appending whole lines
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+    jit->perf_map = fopen(path, "a");
+
+    return 1;
+}
+
+/*
+jit_init
+
+Set [jit] up with no code buffer, which is only allocated once a block turns hot.
+*/
+void jit_init(Jit *jit) {
+    jit->buffer = NULL;
+    jit->used = 0;
+    jit->epoch = 1;
+    jit->failed = 0;
+    jit->perf_map = NULL;
+}
+
+/*
+jit_close
+
+Free [jit]'s code buffer and close its perf map.
+*/
+void jit_close(Jit *jit) {
+    if (jit->buffer) {
+        munmap(jit->buffer, JIT_BUFFER_SIZE);
+    }
+    if (jit->perf_map) {
+        fclose(jit->perf_map);
+    }
+    jit_init(jit);
+}
+
+/*
+jit_run
+
+Run [block], which starts at PC, as native code if it is hot, and charge its cycles
+in one tick. Native code only runs while no interrupt can become pending, so results
+match the interpreter exactly. Return 1 if any instructions were executed.
+*/
+int jit_run(CPU *cpu, Memory *mem, Block *block) {
+    Jit *jit = &cpu->jit;
+
+    // EI delay advances per instruction
+    if (cpu->ime_delay || jit->failed) {
+        return 0;
+    }
+
+    if (!block->native || block->native_epoch != jit->epoch) {
+        if (block->hits == UINT16_MAX || ++block->hits < JIT_HOT_THRESHOLD) {
+            return 0;
+        }
+
+        if (!jit->buffer) {
+            if (!jit_open(jit)) {
+                jit->failed = 1;
+                return 0;
+            }
+        } else if (!jit_protect(jit, 1)) {
+            jit->failed = 1;
+            return 0;
+        }
+
+        // Start a new epoch when the buffer is nearly full
+        if (JIT_BUFFER_SIZE - jit->used < 0x1000) {
+            jit->used = 0;
+            jit->epoch++;
+        }
+
+        // A block that did not fit is compiled again into an empty buffer
+        int full;
+        block->native = jit_compile(jit, block, &full);
+        if (!block->native && full) {
+            jit->used = 0;
+            jit->epoch++;
+            block->native = jit_compile(jit, block, &full);
+        }
+        block->native_epoch = jit->epoch;
+
+        if (!jit_protect(jit, 0)) {
+            block->native = NULL;
+            jit->failed = 1;
+            return 0;
+        }
+
+        // Only code that cannot be translated is given up on for good
+        if (!block->native) {
+            block->hits = full ? 0 : UINT16_MAX;
+            return 0;
+        }
+    }
+
+    // Stop before any instruction that could start after an interrupt becomes pending
+    int budget = cpu->frame_cycles;
+    if (cpu->ime) {
+        int interrupt = cpu_cycles_to_interrupt(cpu, mem);
+        budget = (interrupt < budget) ? interrupt : budget;
+    }
+
+    // Native code reads and writes f directly
+    sync_flags(cpu);
+
+    int cycles = ((jit_fn)block->native)(cpu, budget);
+    if (!cycles) {
+        return 0;
+    }
+
+    cpu->block_cache.current = NULL;
+    tick(cpu, cycles);
+    return 1;
+}
+
+#endif
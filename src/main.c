@@ -1,11 +1,42 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "cpu.h"
+#include "emu.h"
 #include "gb.h"
+#include "headless.h"
 #include "memory.h"
 #include "ppu.h"
 #include "keybinds.h"
 
+/*
+print_usage
+
+Print the command line options.
+*/
+static void print_usage(const char *program) {
+    printf("Usage: %s [path/to/rom.gb]\n", program);
+    printf("Or drag and drop a ROM file onto the window.\n");
+    printf("\n");
+    printf("       %s --headless [options] path/to/rom.gb\n", program);
+    printf("Run with no window, as fast as possible, for N frames or until frame K is written:\n");
+    printf("  --frames N            Stop after N frames of emulated time, N > 0\n");
+    printf("  --dump-frame K FILE   Write the Kth displayed frame, from 0, to FILE as a PPM\n");
+    printf("  --input FILE          Take joypad input from a movie file\n");
+}
+
+/*
+parse_count
+
+Parse a non-negative decimal count, returning -1 if [text] is not one.
+*/
+static long parse_count(const char *text) {
+    char *end;
+    long value = strtol(text, &end, 10);
+    return (*text && *end == '\0' && value >= 0) ? value : -1;
+}
+
 int main(int argc, char *argv[]) {
 
     // Initialize core components
@@ -13,16 +44,62 @@ int main(int argc, char *argv[]) {
     CPU cpu;
     PPU ppu;
     Memory mem;
+    Emu emu;
 
     Status status;
 
-    // Argument check
-    if (argc > 2) {
-        printf("Usage: %s [path/to/rom.gb]\n", argv[0]);
-        printf("Or drag and drop a ROM file onto the window.\n");
+    // Argument parsing
+    const char *rom_path = NULL;
+    int headless = 0;
+    HeadlessOptions options = {.frames = 0, .dump_frame = -1, .dump_path = NULL, .input_path = NULL};
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless = 1;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc && parse_count(argv[i + 1]) > 0) {
+            options.frames = parse_count(argv[++i]);
+        } else if (strcmp(argv[i], "--dump-frame") == 0 && i + 2 < argc && parse_count(argv[i + 1]) >= 0) {
+            options.dump_frame = parse_count(argv[++i]);
+            options.dump_path = argv[++i];
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            options.input_path = argv[++i];
+        } else if (argv[i][0] != '-' && !rom_path) {
+            rom_path = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return ERR_BAD_ARGS;
+        }
+    }
+
+    // The run options only apply to headless runs, which need a ROM and a point to stop at
+    int run_options = options.frames || options.dump_path || options.input_path;
+    int bounded = options.frames || options.dump_path;
+    if ((run_options && !headless) || (headless && (!rom_path || !bounded))) {
+        print_usage(argv[0]);
         return ERR_BAD_ARGS;
     }
 
+    // Headless: no SDL subsystems, window or keybinds, just the ROM run flat out
+    if (headless) {
+        status = GB_init(&gb, &cpu, &ppu, &mem);
+        if (status != OK) {
+            printf("System initialization error.\n");
+            return status;
+        }
+
+        status = GB_load_rom(&gb, rom_path);
+        if (status != OK) {
+            printf("Failed to read ROM: %s\n", rom_path);
+            return status;
+        }
+
+        status = headless_run(&gb, &options);
+        mbc_close(gb.mem);
+        cpu_report_idle(&cpu);
+        cpu_close(&cpu);
+        return status;
+    }
+
     // SDL init
     status = SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_EVENTS);
     if (status != 0) {
@@ -31,37 +108,40 @@ int main(int argc, char *argv[]) {
     }
 
     status = GB_init(&gb, &cpu, &ppu, &mem);
+    if (status == OK) {
+        status = ppu_open_window(gb.ppu);
+    }
     if (status != OK) {
         printf("System initialization error.\n");
         SDL_Quit();
         return status;
     }
 
+    emu_init(&emu, &gb);
+
     // Load ROM if provided as argument
-    if (argc == 2) {
-        status = GB_load_rom(&gb, argv[1]);
+    if (rom_path) {
+        status = GB_load_rom(&gb, rom_path);
         if (status != OK) {
-            printf("Failed to read ROM: %s\n", argv[1]);
+            printf("Failed to read ROM: %s\n", rom_path);
             printf("Drag and drop a .gb file onto the window to load a ROM.\n");
         } else {
-            printf("ROM loaded: %s\n", argv[1]);
+            printf("ROM loaded: %s\n", rom_path);
         }
     } else {
         printf("No ROM loaded. Drag and drop a .gb file onto the window.\n");
     }
 
-    // Timing constants
-    uint64_t perf_freq = SDL_GetPerformanceFrequency();
-    double perf_freq_inv = 1.0 / (double) perf_freq; // Precalculate inverse of perf_freq to avoid doing extra division per frame
-    uint64_t start_counter = SDL_GetPerformanceCounter();
-    double next_frame_time = 0.0;
-
     // FPS tracking
-    uint64_t fps_timer = start_counter;
-    int fps_frames = 0;
+    uint64_t perf_freq = SDL_GetPerformanceFrequency();
+    double perf_freq_inv = 1.0 / (double) perf_freq;
+    uint64_t fps_timer = SDL_GetPerformanceCounter();
     double fps = 0.0;
     char title[128];
 
+    // Joypad state last sent to the emulation thread
+    uint8_t joypad = 0xFF;
+
     // Keybinds for menu
     Keybinds keybinds = {
         .up = SDLK_UP,
@@ -87,6 +167,12 @@ int main(int argc, char *argv[]) {
     int running = 1;
     int fullscreen = 0;
 
+    // Emulation runs on its own thread while a ROM is loaded, this one handles
+    // events and presentation
+    if (gb.rom_loaded) {
+        emu_start(&emu);
+    }
+
     // Main loop
     while (running) {
 
@@ -102,11 +188,13 @@ int main(int argc, char *argv[]) {
                 printf("Loading ROM: %s\n", dropped_file);
 
                 // Load new ROM
+                emu_stop(&emu);
                 status = GB_load_rom(&gb, dropped_file);
                 if (status != OK) {
                     printf("Failed to load ROM: %s\n", dropped_file);
                 } else {
                     printf("ROM loaded successfully\n");
+                    emu_start(&emu);
                 }
 
                 SDL_free(dropped_file);
@@ -116,32 +204,38 @@ int main(int argc, char *argv[]) {
                 int pressed = (event.type == SDL_KEYDOWN);
 
                 // Dynamic keybinds
+                uint8_t joypad_before = joypad;
                 if (event.key.keysym.sym == keybinds.right)
-                    gb.joypad_state = pressed ? (gb.joypad_state & ~0x01) : (gb.joypad_state | 0x01);
+                    joypad = pressed ? (joypad & ~0x01) : (joypad | 0x01);
                 if (event.key.keysym.sym == keybinds.left)
-                    gb.joypad_state = pressed ? (gb.joypad_state & ~0x02) : (gb.joypad_state | 0x02);
+                    joypad = pressed ? (joypad & ~0x02) : (joypad | 0x02);
                 if (event.key.keysym.sym == keybinds.up)
-                    gb.joypad_state = pressed ? (gb.joypad_state & ~0x04) : (gb.joypad_state | 0x04);
+                    joypad = pressed ? (joypad & ~0x04) : (joypad | 0x04);
                 if (event.key.keysym.sym == keybinds.down)
-                    gb.joypad_state = pressed ? (gb.joypad_state & ~0x08) : (gb.joypad_state | 0x08);
+                    joypad = pressed ? (joypad & ~0x08) : (joypad | 0x08);
                 if (event.key.keysym.sym == keybinds.a)
-                    gb.joypad_state = pressed ? (gb.joypad_state & ~0x10) : (gb.joypad_state | 0x10);
+                    joypad = pressed ? (joypad & ~0x10) : (joypad | 0x10);
                 if (event.key.keysym.sym == keybinds.b)
-                    gb.joypad_state = pressed ? (gb.joypad_state & ~0x20) : (gb.joypad_state | 0x20);
+                    joypad = pressed ? (joypad & ~0x20) : (joypad | 0x20);
                 if (event.key.keysym.sym == keybinds.select)
-                    gb.joypad_state = pressed ? (gb.joypad_state & ~0x40) : (gb.joypad_state | 0x40);
+                    joypad = pressed ? (joypad & ~0x40) : (joypad | 0x40);
                 if (event.key.keysym.sym == keybinds.start)
-                    gb.joypad_state = pressed ? (gb.joypad_state & ~0x80) : (gb.joypad_state | 0x80);
+                    joypad = pressed ? (joypad & ~0x80) : (joypad | 0x80);
+                if (joypad != joypad_before) {
+                    emu_send_input(&emu, INPUT_JOYPAD, joypad);
+                }
                 if (event.key.keysym.sym == keybinds.keybinds_menu) {
                     if (event.key.repeat || !pressed) {
                         break;
                     }
-                    show_keybind_menu(&keybinds);
 
-                    // Resync timers after returning from menu to avoid large time jumps
-                    start_counter = SDL_GetPerformanceCounter();
-                    next_frame_time = 0.0;
-                    fps_timer = start_counter;
+                    // Hold emulation while the menu is open, frame pacing restarts with the thread
+                    emu_stop(&emu);
+                    show_keybind_menu(&keybinds);
+                    if (gb.rom_loaded) {
+                        emu_start(&emu);
+                    }
+                    fps_timer = SDL_GetPerformanceCounter();
                 }
                 if (event.key.keysym.sym == keybinds.reset) {
                     if (event.key.repeat || !pressed) {
@@ -151,9 +245,11 @@ int main(int argc, char *argv[]) {
                         printf("No ROM loaded to reset\n");
                         break;
                     }
+                    emu_stop(&emu);
                     cpu_init(gb.cpu, &gb);
                     mem_init(gb.mem, &gb);
                     ppu_reset(gb.ppu);
+                    emu_start(&emu);
                     printf("Emulator reset\n");
                 }
                 if (event.key.keysym.sym == keybinds.palette_swap) {
@@ -166,13 +262,13 @@ int main(int argc, char *argv[]) {
                     if (event.key.repeat || !pressed) {
                         break;
                     }
-                    gb.turbo ^= 1;
+                    emu_send_input(&emu, INPUT_TURBO, 0);
                 }
                 if (event.key.keysym.sym == keybinds.pause) {
                     if (event.key.repeat || !pressed) {
                         break;
                     }
-                    gb.paused ^= 1;
+                    emu_send_input(&emu, INPUT_PAUSE, 0);
                 }
                 if (event.key.keysym.sym == keybinds.fullscreen) {
                     if (event.key.repeat || !pressed) {
@@ -189,43 +285,36 @@ int main(int argc, char *argv[]) {
             }
         }
 
-        // Only run emulation if ROM is loaded
-        if (gb.rom_loaded) {
-            gb.cpu->frame_cycles = gb.paused ? 0 : CYCLES_PER_FRAME;
-            while (gb.cpu->frame_cycles > 0) {
-                cpu_step(gb.cpu, gb.mem);
-            }
+        // Show the newest finished frame, or wait a little for one
+        if (ppu_take_frame(gb.ppu)) {
+            ppu_present(gb.ppu);
+        } else {
+            SDL_Delay(1);
+        }
 
-            // Update FPS counter
-            fps_frames++;
-            uint64_t now_counter = SDL_GetPerformanceCounter();
-            double fps_elapsed = (double)(now_counter - fps_timer) * perf_freq_inv;
+        // Update FPS counter with the frames emulated since the last update
+        uint64_t now_counter = SDL_GetPerformanceCounter();
+        double fps_elapsed = (double)(now_counter - fps_timer) * perf_freq_inv;
 
-            if (fps_elapsed >= 1.0) {
-                fps = fps_frames / fps_elapsed;
+        if (fps_elapsed >= 1.0) {
+            fps = SDL_AtomicSet(&emu.frames, 0) / fps_elapsed;
+            if (gb.rom_loaded) {
                 snprintf(title, sizeof(title), "C-GB | %.2f FPS", fps);
                 SDL_SetWindowTitle(gb.ppu->window, title);
-
-                fps_frames = 0;
-                fps_timer = now_counter;
             }
 
-            // Limit performance to ~59.7 FPS when not in turbo mode
-            double now = (double)(now_counter - start_counter) * perf_freq_inv;
-            if (!gb.turbo) {
-                if (now < next_frame_time) {
-                    double delay = next_frame_time - now;
-                    SDL_Delay((uint32_t)(delay * 1000.0));
-                }
-                next_frame_time += FRAME_TIME;
-            } else {
-                next_frame_time = now;
-            }
+            fps_timer = now_counter;
         }
     }
 
-    // Save keybinds to file on exit
+    // Stop emulation, then save keybinds to file and flush battery RAM on exit
+    emu_stop(&emu);
     save_keybinds(&keybinds);
+    mbc_close(gb.mem);
+
+    // Report idle loop statistics and free the native code
+    cpu_report_idle(&cpu);
+    cpu_close(&cpu);
 
     // Cleanup
     SDL_DestroyTexture(gb.ppu->texture);
@@ -0,0 +1,786 @@
+// mmap, msync and sysconf
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cpu.h"
+#include "mbc.h"
+#include "memory.h"
+
+#if HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Open bus contents mapped while no ROM is loaded
+static uint8_t empty_rom[ROM_BANK_0_SIZE + ROM_BANK_N_SIZE];
+
+/*
+mbc_ram_size
+
+Return the cartridge RAM size in bytes declared by header byte 0x149.
+*/
+static uint32_t mbc_ram_size(uint8_t code) {
+    switch (code) {
+    case 0x01: // 2 KB, rounded up to a full bank
+    case 0x02:
+        return 0x2000;
+    case 0x03:
+        return 0x8000;
+    case 0x04:
+        return 0x20000;
+    case 0x05:
+        return 0x10000;
+    default:
+        return 0;
+    }
+}
+
+/*
+mbc_has_battery
+
+Return whether cartridge type [type] keeps its RAM or clock powered by a battery.
+*/
+static int mbc_has_battery(uint8_t type) {
+    switch (type) {
+    case 0x03:
+    case 0x06:
+    case 0x09:
+    case 0x0D:
+    case 0x0F:
+    case 0x10:
+    case 0x13:
+    case 0x1B:
+    case 0x1E:
+    case 0x22:
+    case 0xFF:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+mbc_now
+
+Return the master clock, which drives the real-time clock while the emulator runs.
+*/
+static uint64_t mbc_now(Memory *mem) {
+    return mem->gb ? mem->gb->scheduler.now : 0;
+}
+
+/*
+rtc_add_seconds
+
+Advance the clock registers by [seconds], carrying into minutes, hours and the 9-bit
+day counter. Overflowing day 511 sets the day carry flag. Registers written out of
+range count up to their field width before wrapping, like the hardware.
+*/
+static void rtc_add_seconds(Rtc *rtc, uint64_t seconds) {
+    while (seconds) {
+
+        // Every field can be carried at once while the registers are in range
+        if (rtc->regs[0] < 60 && rtc->regs[1] < 60 && rtc->regs[2] < 24) {
+            uint64_t total = rtc->regs[0] + seconds;
+            uint64_t minutes = rtc->regs[1] + total / 60;
+            uint64_t hours = rtc->regs[2] + minutes / 60;
+            uint64_t days = ((rtc->regs[4] & 0x01) << 8 | rtc->regs[3]) + hours / 24;
+
+            rtc->regs[0] = total % 60;
+            rtc->regs[1] = minutes % 60;
+            rtc->regs[2] = hours % 24;
+            if (days > 0x1FF) {
+                rtc->regs[4] |= 0x80;
+            }
+            days &= 0x1FF;
+            rtc->regs[3] = days & 0xFF;
+            rtc->regs[4] = (rtc->regs[4] & 0xFE) | (days >> 8);
+            return;
+        }
+
+        // Out of range registers tick one second at a time until they wrap
+        seconds--;
+        rtc->regs[0] = (rtc->regs[0] + 1) & 0x3F;
+        if (rtc->regs[0] == 60) {
+            rtc->regs[0] = 0;
+            rtc->regs[1] = (rtc->regs[1] + 1) & 0x3F;
+            if (rtc->regs[1] == 60) {
+                rtc->regs[1] = 0;
+                rtc->regs[2] = (rtc->regs[2] + 1) & 0x1F;
+                if (rtc->regs[2] == 24) {
+                    rtc->regs[2] = 0;
+                    if (++rtc->regs[3] == 0) {
+                        if (rtc->regs[4] & 0x01) {
+                            rtc->regs[4] |= 0x80;
+                        }
+                        rtc->regs[4] ^= 0x01;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/*
+rtc_update
+
+Bring the clock registers up to the master clock time [now]. The clock is not ticked
+while the game runs; the elapsed time is worked out only when the registers are
+latched, written or saved.
+*/
+static void rtc_update(Rtc *rtc, uint64_t now) {
+    if (!(rtc->regs[4] & 0x40) && now > rtc->base_cycle) {
+        uint64_t total = rtc->subsecond + (now - rtc->base_cycle);
+        rtc->subsecond = total % CYCLES_PER_SECOND;
+        rtc_add_seconds(rtc, total / CYCLES_PER_SECOND);
+    }
+    rtc->base_cycle = now;
+}
+
+/*
+mbc_save_path
+
+Derive the save file path from [rom_path] by replacing its extension with .sav.
+*/
+static void mbc_save_path(Cartridge *cart, const char *rom_path) {
+    cart->save_path[0] = '\0';
+    if (!rom_path) {
+        return;
+    }
+
+    size_t len = strlen(rom_path);
+    const char *dot = strrchr(rom_path, '.');
+    if (dot && !strpbrk(dot, "/\\")) {
+        len = dot - rom_path;
+    }
+    if (len + 5 > sizeof(cart->save_path)) {
+        return;
+    }
+
+    memcpy(cart->save_path, rom_path, len);
+    memcpy(cart->save_path + len, ".sav", 5);
+}
+
+/*
+mbc_put32, mbc_get32
+
+Store and load little-endian 32-bit fields of the save file clock footer.
+*/
+static void mbc_put32(uint8_t *p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static uint32_t mbc_get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+mbc_mark_dirty
+
+Flag the part [bit] of the save file as changed since the last flush: a RAM bank
+number, or SAVE_DIRTY_CLOCK for the clock footer. Only the first write after a flush
+pays for the atomic update.
+*/
+static void mbc_mark_dirty(Cartridge *cart, int bit) {
+    int mask = 1 << bit;
+    int old = SDL_AtomicGet(&cart->dirty);
+    while (!(old & mask) && !SDL_AtomicCAS(&cart->dirty, old, old | mask)) {
+        old = SDL_AtomicGet(&cart->dirty);
+    }
+}
+
+/*
+mbc_store_clock
+
+Bring the clock up to date and store it in the save file footer with the wall-clock
+time, so the time until the next start can be added on load.
+*/
+static void mbc_store_clock(Memory *mem) {
+    Cartridge *cart = &mem->cart;
+    if (!cart->has_rtc || !cart->save_map) {
+        return;
+    }
+
+    Rtc *rtc = &cart->rtc;
+    rtc_update(rtc, mbc_now(mem));
+
+    uint8_t *footer = cart->save_map + cart->ram_banks * ERAM_SIZE;
+    for (int i = 0; i < RTC_REGS; i++) {
+        mbc_put32(footer + i * 4, rtc->regs[i]);
+        mbc_put32(footer + (RTC_REGS + i) * 4, rtc->latched[i]);
+    }
+
+    uint64_t now = (uint64_t)time(NULL);
+    mbc_put32(footer + 40, (uint32_t)now);
+    mbc_put32(footer + 44, (uint32_t)(now >> 32));
+    mbc_mark_dirty(cart, SAVE_DIRTY_CLOCK);
+}
+
+/*
+mbc_flush
+
+Write the parts of the save file marked dirty back to disk. Runs on the flush thread,
+which owns the msync or fwrite calls so the emulation thread never waits for the disk.
+Writes that land after the dirty mask is taken set it again for the next flush.
+*/
+static void mbc_flush(Cartridge *cart) {
+    int dirty = SDL_AtomicSet(&cart->dirty, 0);
+    if (!dirty) {
+        return;
+    }
+
+#if HAVE_MMAP
+    uintptr_t page_mask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+#endif
+    uint32_t ram_size = cart->ram_banks * ERAM_SIZE;
+
+    for (int bit = 0; bit <= SAVE_DIRTY_CLOCK; bit++) {
+        if (!(dirty & (1 << bit))) {
+            continue;
+        }
+
+        uint32_t offset = (bit == SAVE_DIRTY_CLOCK) ? ram_size : (uint32_t)bit * ERAM_SIZE;
+        uint32_t size = (bit == SAVE_DIRTY_CLOCK) ? RTC_SAVE_SIZE : ERAM_SIZE;
+
+#if HAVE_MMAP
+        // msync needs a page aligned start
+        uintptr_t start = (uintptr_t)(cart->save_map + offset);
+        uintptr_t aligned = start & ~page_mask;
+        msync((void *)aligned, size + (start - aligned), MS_SYNC);
+#else
+        if (fseek(cart->save_file, offset, SEEK_SET) == 0) {
+            fwrite(cart->save_map + offset, 1, size, cart->save_file);
+        }
+#endif
+    }
+
+#if !HAVE_MMAP
+    fflush(cart->save_file);
+#endif
+}
+
+/*
+mbc_flush_thread
+
+Flush the save file every SAVE_FLUSH_INTERVAL_MS until asked to stop, then once more
+so nothing written before the stop is lost.
+*/
+static int mbc_flush_thread(void *data) {
+    Cartridge *cart = data;
+
+    while (SDL_SemWaitTimeout(cart->flush_stop, SAVE_FLUSH_INTERVAL_MS) == SDL_MUTEX_TIMEDOUT) {
+        mbc_flush(cart);
+    }
+
+    mbc_flush(cart);
+    return 0;
+}
+
+/*
+mbc_open_save
+
+Map the save file next to the ROM as the cartridge RAM, creating or growing it to
+the RAM size plus the clock footer. Battery RAM then persists through ordinary stores
+to the mapping, and a flush thread writes the dirty parts back in the background.
+Without mmap, the file is read into a heap copy instead, which the flush thread writes
+back with stdio. Time spent with the emulator closed is added to a running clock.
+Returns 0 if the file cannot be mapped, leaving the cartridge without a save.
+*/
+static int mbc_open_save(Memory *mem, uint32_t ram_size) {
+    Cartridge *cart = &mem->cart;
+    uint32_t save_size = ram_size + (cart->has_rtc ? RTC_SAVE_SIZE : 0);
+
+#if HAVE_MMAP
+    int fd = open(cart->save_path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 0;
+    }
+
+    // A longer file may come from another emulator or a different RAM size. Without a
+    // clock only the RAM prefix is mapped and the rest is left alone, but the clock
+    // footer would land on bytes the file already uses, so such a file is not touched.
+    if (st.st_size > save_size && cart->has_rtc) {
+        printf("Warning: %s is %lld bytes, more than the %u expected\n", cart->save_path, (long long)st.st_size,
+               save_size);
+        close(fd);
+        return 0;
+    }
+
+    // Growing the file fills the new part with zeros. A save file is never shrunk.
+    if (st.st_size < save_size && ftruncate(fd, save_size) != 0) {
+        close(fd);
+        return 0;
+    }
+
+    uint8_t *map = mmap(NULL, save_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+    long long file_size = st.st_size;
+#else
+    FILE *file = fopen(cart->save_path, "r+b");
+    if (!file) {
+        file = fopen(cart->save_path, "w+b");
+    }
+    if (!file) {
+        return 0;
+    }
+
+    long long file_size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        file_size = ftell(file);
+    }
+    if (file_size < 0) {
+        fclose(file);
+        return 0;
+    }
+
+    // Same rule as the mapping: a longer file holding a clock is not touched
+    if (file_size > save_size && cart->has_rtc) {
+        printf("Warning: %s is %lld bytes, more than the %u expected\n", cart->save_path, file_size, save_size);
+        fclose(file);
+        return 0;
+    }
+
+    // Read what the file holds, leaving the rest zero as a grown file would be
+    uint8_t *map = calloc(1, save_size);
+    if (!map) {
+        fclose(file);
+        return 0;
+    }
+    uint32_t read_size = file_size < save_size ? (uint32_t)file_size : save_size;
+    if (fseek(file, 0, SEEK_SET) != 0 || fread(map, 1, read_size, file) != read_size) {
+        free(map);
+        fclose(file);
+        return 0;
+    }
+
+    cart->save_file = file;
+#endif
+
+    cart->save_map = map;
+    cart->save_size = save_size;
+    cart->ram = ram_size ? map : NULL;
+    cart->ram_banks = ram_size / ERAM_SIZE;
+
+    // Restore the clock if the file already held one
+    if (cart->has_rtc && file_size == save_size) {
+        Rtc *rtc = &cart->rtc;
+        const uint8_t *footer = map + ram_size;
+        for (int i = 0; i < RTC_REGS; i++) {
+            rtc->regs[i] = mbc_get32(footer + i * 4);
+            rtc->latched[i] = mbc_get32(footer + (RTC_REGS + i) * 4);
+        }
+
+        uint64_t saved = mbc_get32(footer + 40) | (uint64_t)mbc_get32(footer + 44) << 32;
+        uint64_t now = (uint64_t)time(NULL);
+        if (!(rtc->regs[4] & 0x40) && now > saved) {
+            rtc_add_seconds(rtc, now - saved);
+        }
+        rtc->base_cycle = mbc_now(mem);
+    }
+
+    SDL_AtomicSet(&cart->dirty, 0);
+#if !HAVE_MMAP
+    // Grow a short file on the first flush
+    if (file_size < save_size) {
+        for (uint32_t bank = 0; bank < cart->ram_banks; bank++) {
+            mbc_mark_dirty(cart, bank);
+        }
+    }
+#endif
+    mbc_store_clock(mem);
+
+    cart->flush_stop = SDL_CreateSemaphore(0);
+    cart->flush_thread = cart->flush_stop ? SDL_CreateThread(mbc_flush_thread, "save flush", cart) : NULL;
+    if (!cart->flush_thread) {
+        printf("Warning: Cannot start the save thread, %s is only written on exit\n", cart->save_path);
+    }
+
+    return 1;
+}
+
+/*
+mbc_close
+
+Release the cartridge: store the clock, stop the flush thread after a final flush
+and unmap the save file and ROM image.
+*/
+void mbc_close(Memory *mem) {
+    Cartridge *cart = &mem->cart;
+
+    if (cart->save_map) {
+        mbc_store_clock(mem);
+        if (cart->flush_thread) {
+            SDL_SemPost(cart->flush_stop);
+            SDL_WaitThread(cart->flush_thread, NULL);
+        } else {
+            mbc_flush(cart);
+        }
+        if (cart->flush_stop) {
+            SDL_DestroySemaphore(cart->flush_stop);
+        }
+#if HAVE_MMAP
+        munmap(cart->save_map, cart->save_size);
+#else
+        fclose(cart->save_file);
+        free(cart->save_map);
+#endif
+    } else {
+        free(cart->ram);
+    }
+
+#if HAVE_MMAP
+    if (cart->rom_mapped) {
+        munmap(cart->rom, cart->rom_banks * ROM_BANK_N_SIZE);
+    } else {
+        free(cart->rom);
+    }
+#else
+    free(cart->rom);
+#endif
+
+    cart->rom = NULL;
+    cart->rom_banks = 0;
+    cart->rom_mapped = 0;
+    cart->ram = NULL;
+    cart->ram_banks = 0;
+    cart->save_map = NULL;
+    cart->save_size = 0;
+#if !HAVE_MMAP
+    cart->save_file = NULL;
+#endif
+    cart->flush_thread = NULL;
+    cart->flush_stop = NULL;
+}
+
+/*
+mbc_init
+
+Take ownership of the ROM image [rom] of [rom_size] bytes, a power of two of at least
+32 KB, which is a file mapping if [rom_mapped] and a heap allocation otherwise.
+Detect the memory bank controller from header byte 0x147, allocate cartridge RAM and
+map bank 0 and 1. Unsupported controllers run as ROM only. The previous cartridge is
+closed, and battery RAM is mapped from the save file next to [rom_path].
+*/
+Status mbc_init(Memory *mem, uint8_t *rom, uint32_t rom_size, int rom_mapped, const char *rom_path) {
+    Cartridge *cart = &mem->cart;
+
+    // Release the previous cartridge
+    mbc_close(mem);
+
+    cart->rom = rom;
+    cart->rom_banks = rom_size / ROM_BANK_N_SIZE;
+    cart->rom_mapped = rom_mapped;
+
+    uint8_t type = rom[0x147];
+    uint32_t ram_size = mbc_ram_size(rom[0x149]);
+
+    cart->battery = mbc_has_battery(type);
+    cart->has_rtc = (type == 0x0F || type == 0x10);
+    memset(&cart->rtc, 0, sizeof(cart->rtc));
+    cart->rtc.base_cycle = mbc_now(mem);
+    mbc_save_path(cart, rom_path);
+
+    switch (type) {
+    case 0x00: // ROM only
+    case 0x08: // ROM + RAM
+    case 0x09: // ROM + RAM + battery
+        cart->type = MBC_NONE;
+        ram_size = ERAM_SIZE;
+        break;
+    case 0x01: // MBC1
+    case 0x02: // MBC1 + RAM
+    case 0x03: // MBC1 + RAM + battery
+        cart->type = MBC_1;
+        break;
+    case 0x0F: // MBC3 + timer + battery
+    case 0x10: // MBC3 + timer + RAM + battery
+    case 0x11: // MBC3
+    case 0x12: // MBC3 + RAM
+    case 0x13: // MBC3 + RAM + battery
+        cart->type = MBC_3;
+        break;
+    case 0x19: // MBC5
+    case 0x1A: // MBC5 + RAM
+    case 0x1B: // MBC5 + RAM + battery
+    case 0x1C: // MBC5 + rumble
+    case 0x1D: // MBC5 + rumble + RAM
+    case 0x1E: // MBC5 + rumble + RAM + battery
+        cart->type = MBC_5;
+        break;
+    default:
+        printf("Warning: Cartridge type %02X is not supported, running as ROM only\n", type);
+        cart->type = MBC_NONE;
+        ram_size = ERAM_SIZE;
+        break;
+    }
+
+    // Battery RAM and the clock live in the save file, other RAM on the heap
+    int saved = 0;
+    if (cart->battery && cart->save_path[0] && (ram_size || cart->has_rtc)) {
+        saved = mbc_open_save(mem, ram_size);
+        if (!saved) {
+            printf("Warning: Cannot open save file %s, progress will not be kept\n", cart->save_path);
+        }
+    }
+
+    if (ram_size && !saved) {
+        cart->ram = calloc(1, ram_size);
+        if (!cart->ram) {
+            return ERR_BAD_FILE;
+        }
+        cart->ram_banks = ram_size / ERAM_SIZE;
+    }
+
+    // Battery RAM is not cleared by the reset
+    mbc_reset(mem);
+    return OK;
+}
+
+/*
+mbc_update_map
+
+Point rom0, romN and eram at the banks selected by the bank registers and update
+the pages of each window that moved, or of all three if [full] is set. Switching
+banks only moves pointers. eram is NULL while RAM is disabled or absent, which leaves
+its pages on the slow path. Battery RAM is read through the page table but written on
+the slow path, which tracks dirty banks of the save file.
+*/
+static void mbc_update_map(Memory *mem, int full) {
+    Cartridge *cart = &mem->cart;
+    uint32_t rom0_bank = 0;
+    uint32_t romN_bank = 1;
+    uint32_t ram_bank = 0;
+    int ram_enabled = (cart->ram != NULL);
+
+    switch (cart->type) {
+    case MBC_1:
+        romN_bank = (cart->ram_bank << 5) | cart->rom_bank;
+        if (cart->mode) {
+            rom0_bank = cart->ram_bank << 5;
+            ram_bank = cart->ram_bank;
+        }
+        ram_enabled = ram_enabled && cart->ram_enable;
+        break;
+    case MBC_3:
+        // Selecting a clock register unmaps RAM so accesses reach mbc_read and mbc_write
+        romN_bank = cart->rom_bank;
+        ram_bank = cart->ram_bank;
+        ram_enabled = ram_enabled && cart->ram_enable && cart->ram_bank < 0x04;
+        break;
+    case MBC_5:
+        romN_bank = cart->rom_bank;
+        ram_bank = cart->ram_bank;
+        ram_enabled = ram_enabled && cart->ram_enable;
+        break;
+    default:
+        break;
+    }
+
+    uint8_t *rom0;
+    uint8_t *romN;
+    if (cart->rom) {
+        rom0_bank &= cart->rom_banks - 1;
+        romN_bank &= cart->rom_banks - 1;
+        rom0 = cart->rom + rom0_bank * ROM_BANK_N_SIZE;
+        romN = cart->rom + romN_bank * ROM_BANK_N_SIZE;
+    } else {
+        if (full) {
+            memset(empty_rom, 0xFF, sizeof(empty_rom));
+        }
+        rom0 = empty_rom;
+        romN = empty_rom + ROM_BANK_0_SIZE;
+    }
+
+    uint8_t *eram = ram_enabled ? cart->ram + (ram_bank & (cart->ram_banks - 1)) * ERAM_SIZE : NULL;
+
+    if (!full && rom0 == mem->rom0 && romN == mem->romN && eram == mem->eram) {
+        return;
+    }
+
+    // Code cached from the old banks is looked up again under the new ones
+    if (mem->rom0_bank != rom0_bank || mem->rom_bank != romN_bank) {
+        mem->rom0_bank = rom0_bank;
+        mem->rom_bank = romN_bank;
+        if (mem->gb) {
+            mem->gb->cpu->block_cache.current = NULL;
+        }
+    }
+
+    if (full || rom0 != mem->rom0) {
+        mem->rom0 = rom0;
+        for (int page = 0; page < 0x40; page++) {
+            mem->read_page[page] = rom0 + (page << 8);
+        }
+    }
+
+    if (full || romN != mem->romN) {
+        mem->romN = romN;
+        for (int page = 0; page < 0x40; page++) {
+            mem->read_page[page + 0x40] = romN + (page << 8);
+        }
+    }
+
+    if (full || eram != mem->eram) {
+        mem->eram = eram;
+        for (int page = 0; page < 0x20; page++) {
+            uint8_t *ptr = eram ? eram + (page << 8) : NULL;
+            mem->read_page[page + 0xA0] = ptr;
+            mem->write_page[page + 0xA0] = cart->save_map ? NULL : ptr;
+        }
+    }
+}
+
+/*
+mbc_map
+
+Remap the cartridge windows after a bank register write, touching only the pages of
+windows whose bank changed.
+*/
+void mbc_map(Memory *mem) {
+    mbc_update_map(mem, 0);
+}
+
+/*
+mbc_reset
+
+Clear cartridge RAM and return the bank registers to their power-on state. Battery
+backed RAM and the clock keep their contents.
+*/
+void mbc_reset(Memory *mem) {
+    Cartridge *cart = &mem->cart;
+
+    if (cart->ram && !cart->battery) {
+        memset(cart->ram, 0, cart->ram_banks * ERAM_SIZE);
+    }
+
+    cart->ram_enable = 0;
+    cart->rom_bank = 1;
+    cart->ram_bank = 0;
+    cart->mode = 0;
+
+    // The page table may have been rebuilt, so map every window
+    mbc_update_map(mem, 1);
+}
+
+/*
+mbc_read
+
+Handle a read from A000–BFFF while no RAM bank is mapped there. MBC3 returns the
+latched clock register that is selected, anything else reads as open bus.
+*/
+uint8_t mbc_read(Memory *mem, uint16_t addr) {
+    (void)addr;
+    Cartridge *cart = &mem->cart;
+
+    if (cart->type == MBC_3 && cart->has_rtc && cart->ram_enable && cart->ram_bank >= 0x08 &&
+        cart->ram_bank <= 0x0C) {
+        return cart->rtc.latched[cart->ram_bank - 0x08];
+    }
+    return 0xFF;
+}
+
+/*
+mbc_write
+
+Handle a write to the bank registers at 0000–7FFF, or to A000–BFFF while it has no
+write page: battery RAM, whose writes are tracked for the flush thread, or no RAM.
+*/
+void mbc_write(Memory *mem, uint16_t addr, uint8_t value) {
+    Cartridge *cart = &mem->cart;
+
+    if (addr >= 0xA000) {
+        if (mem->eram) {
+            mem->eram[addr - 0xA000] = value;
+            mbc_mark_dirty(cart, (mem->eram - cart->ram) / ERAM_SIZE);
+            return;
+        }
+
+        // Only the clock registers respond to writes to unmapped RAM
+        if (cart->type != MBC_3) {
+            return;
+        }
+    }
+
+    switch (cart->type) {
+
+    case MBC_1:
+        if (addr < 0x2000) {
+            cart->ram_enable = ((value & 0x0F) == 0x0A);
+        } else if (addr < 0x4000) {
+            // Bank 0 is not selectable in the low bits and maps bank 1 instead
+            cart->rom_bank = (value & 0x1F) ? (value & 0x1F) : 1;
+        } else if (addr < 0x6000) {
+            cart->ram_bank = value & 0x03;
+        } else {
+            cart->mode = value & 0x01;
+        }
+        break;
+
+    case MBC_3:
+        if (addr >= 0xA000) {
+            // Clock register write
+            static const uint8_t rtc_masks[RTC_REGS] = {0x3F, 0x3F, 0x1F, 0xFF, 0xC1};
+            if (cart->has_rtc && cart->ram_enable && cart->ram_bank >= 0x08 && cart->ram_bank <= 0x0C) {
+                Rtc *rtc = &cart->rtc;
+                rtc_update(rtc, mbc_now(mem));
+                rtc->regs[cart->ram_bank - 0x08] = value & rtc_masks[cart->ram_bank - 0x08];
+                if (cart->ram_bank == 0x08) {
+                    rtc->subsecond = 0;
+                }
+                mbc_store_clock(mem);
+            }
+            return;
+        }
+        if (addr < 0x2000) {
+            cart->ram_enable = ((value & 0x0F) == 0x0A);
+        } else if (addr < 0x4000) {
+            cart->rom_bank = (value & 0x7F) ? (value & 0x7F) : 1;
+        } else if (addr < 0x6000) {
+            cart->ram_bank = value & 0x0F;
+        } else {
+            // Writing 00 then 01 copies the running clock into the readable registers
+            if (cart->has_rtc && cart->rtc.latch == 0x00 && value == 0x01) {
+                rtc_update(&cart->rtc, mbc_now(mem));
+                memcpy(cart->rtc.latched, cart->rtc.regs, RTC_REGS);
+                mbc_store_clock(mem);
+            }
+            cart->rtc.latch = value;
+            return;
+        }
+        break;
+
+    case MBC_5:
+        if (addr < 0x2000) {
+            cart->ram_enable = ((value & 0x0F) == 0x0A);
+        } else if (addr < 0x3000) {
+            cart->rom_bank = (cart->rom_bank & 0x100) | value;
+        } else if (addr < 0x4000) {
+            cart->rom_bank = (cart->rom_bank & 0xFF) | ((value & 0x01) << 8);
+        } else if (addr < 0x6000) {
+            cart->ram_bank = value & 0x0F;
+        }
+        break;
+
+    default:
+        return;
+    }
+
+    mbc_map(mem);
+}
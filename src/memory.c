@@ -1,40 +1,105 @@
+// mmap
+#define _DEFAULT_SOURCE
+
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "cpu.h"
 #include "memory.h"
 
+#if HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+mem_rom_size
+
+Return the size of the ROM image for a file of [file_size] bytes: a power of two
+number of banks, at least 32KB.
+*/
+static uint32_t mem_rom_size(uint32_t file_size) {
+    uint32_t rom_size = ROM_BANK_0_SIZE + ROM_BANK_N_SIZE;
+    while (rom_size < file_size) {
+        rom_size <<= 1;
+    }
+    return rom_size;
+}
+
 /*
 mem_rom_load
 
-Load the first 32KB of a ROM file into ROM bank 0 and ROM bank N.
-Pads incomplete bank N reads with 0xFF.
+Load a whole ROM file and hand it to the memory bank controller, which also loads any
+save file next to it. Where mmap is available, the file is mapped read-only and shared,
+so every instance running the same game shares one copy in the page cache and only
+the pages that are actually read are loaded. Images that are not a power of two
+number of banks of at least 32KB, and all images on other hosts, are copied instead
+and padded with 0xFF.
 */
 Status mem_rom_load(Memory *mem, const char *filename) {
 
-    FILE *rom_file = fopen(filename, "rb");
-    if (!rom_file) {
+#if HAVE_MMAP
+    // Map the file directly when it needs no padding
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
         return ERR_FILE_NOT_FOUND;
     }
 
-    // Read ROM bank 0 (0000–3FFF)
-    size_t read_bytes = fread(mem->rom0, 1, ROM_BANK_0_SIZE, rom_file);
-    if (read_bytes != ROM_BANK_0_SIZE) {
-        fclose(rom_file);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < ROM_BANK_0_SIZE || st.st_size > ROM_MAX_SIZE) {
+        close(fd);
         return ERR_BAD_FILE;
     }
 
-    // Read ROM bank N (4000–7FFF)
-    read_bytes = fread(mem->romN, 1, ROM_BANK_N_SIZE, rom_file);
-    if (read_bytes != ROM_BANK_N_SIZE) {
-        for (size_t i = read_bytes; i < ROM_BANK_N_SIZE; i++) {
-            mem->romN[i] = 0xFF;
+    if (mem_rom_size((uint32_t)st.st_size) == (uint32_t)st.st_size) {
+        uint8_t *rom = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (rom == MAP_FAILED) {
+            return ERR_BAD_FILE;
         }
+        return mbc_init(mem, rom, (uint32_t)st.st_size, 1, filename);
     }
+    close(fd);
+#endif
 
-    fclose(rom_file);
-    return OK;
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return ERR_FILE_NOT_FOUND;
+    }
+
+    // Get the file size
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        size = ftell(file);
+    }
+    if (size < ROM_BANK_0_SIZE || size > ROM_MAX_SIZE || fseek(file, 0, SEEK_SET) != 0) {
+        fclose(file);
+        return ERR_BAD_FILE;
+    }
+
+    uint32_t file_size = (uint32_t)size;
+    uint32_t rom_size = mem_rom_size(file_size);
+    uint8_t *rom = malloc(rom_size);
+    if (!rom) {
+        fclose(file);
+        return ERR_BAD_FILE;
+    }
+
+    // Read the image
+    size_t read_bytes = fread(rom, 1, file_size, file);
+    fclose(file);
+    if (read_bytes != file_size) {
+        free(rom);
+        return ERR_BAD_FILE;
+    }
+    memset(rom + file_size, 0xFF, rom_size - file_size);
+
+    return mbc_init(mem, rom, rom_size, 0, filename);
 }
 
 /*
@@ -49,7 +114,6 @@ Status mem_init(Memory *mem, GB *gb) {
 
     // Clear memory to 0, preserving ROM data
     memset(mem->vram, 0, VRAM_SIZE);
-    memset(mem->eram, 0, ERAM_SIZE);
     memset(mem->wram0, 0, WRAM_BANK_0_SIZE);
     memset(mem->wram1, 0, WRAM_BANK_1_SIZE);
     memset(mem->oam, 0, OAM_SIZE);
@@ -90,13 +154,59 @@ Status mem_init(Memory *mem, GB *gb) {
 
     // Timer counters
     mem->div_internal = 0;
+    mem->tima_reload_delay = 0;
+
+    // No serial transfer in progress
+    mem->serial_bits = 0;
+
+    // No OAM DMA in progress, the page table is rebuilt below
+    mem->dma_active = 0;
+    mem->dma_source = 0;
+
+    // No cached code yet
+    memset(mem->code_page, 0, sizeof(mem->code_page));
+    memset(mem->code_gen, 0, sizeof(mem->code_gen));
 
     // Set parent pointer
     mem->gb = gb;
 
+    // Clear cartridge RAM and map the first banks
+    mem_map_init(mem);
+    mbc_reset(mem);
+
+    // Register the first timer deadline
+    mem->timer_synced = gb->scheduler.now;
+    mem_timer_schedule(mem);
+    scheduler_cancel(&gb->scheduler, EVENT_SERIAL);
+    scheduler_cancel(&gb->scheduler, EVENT_DMA);
+
     return OK;
 }
 
+/*
+mem_map_init
+
+Point every page with plain memory behind it at its host memory. ROM writes, VRAM
+writes, OAM, the unusable region, I/O and HRAM have side effects and stay on the
+slow path. Echo RAM aliases WRAM. The cartridge pages are mapped by mbc_map.
+*/
+void mem_map_init(Memory *mem) {
+    for (int page = 0; page < 0x100; page++) {
+        uint8_t *ptr = NULL;
+
+        if (page >= 0x80 && page < 0xA0) {
+            ptr = &mem->vram[(page - 0x80) << 8];
+        } else if (page >= 0xC0 && page < 0xFE) {
+            ptr = mem_wram_page(mem, (page < 0xE0) ? page : page - 0x20);
+        }
+
+        mem->read_page[page] = ptr;
+
+        // VRAM writes catch up the PPU first
+        mem->write_page[page] = (page >= 0xC0) ? ptr : NULL;
+    }
+}
+
 /*
 push8
 
@@ -136,64 +246,387 @@ uint16_t pop16(CPU *cpu, Memory *mem) {
     return ((uint16_t)high << 8) | low;
 }
 
+// TIMA input clock period in cycles for each TAC clock select, a falling edge of DIV bit 9, 3, 5 or 7
+static const int timer_periods[4] = {1024, 16, 64, 256};
+
+/*
+mem_timer_step
+
+Advance DIV/TIMA by a single cycle, handling TIMA overflow and delayed reload.
+*/
+static void mem_timer_step(Memory *mem) {
+
+    // Check delayed reload
+    if (mem->tima_reload_delay) {
+        mem->tima_reload_delay--;
+
+        // Reset TIMA to TMA and request timer interrupt
+        if (mem->tima_reload_delay == 0) {
+            mem->io[0x05] = mem->io[0x06];
+            mem->io[0x0F] |= 0x04;
+        }
+    }
+
+    // DIV register
+    uint16_t old_div = mem->div_internal;
+    mem->div_internal++;
+    mem->io[0x04] = mem->div_internal >> 8;
+
+    // Increment TIMA on falling edge of the selected bit, and prepare for timer interrupt on overflow
+    uint8_t tac = mem->io[0x07];
+    if ((tac & 0x04) && (old_div & ~mem->div_internal & (timer_periods[tac & 0x03] >> 1))) {
+        if (mem->io[0x05] == 0xFF) {
+            mem->io[0x05] = 0x00;
+            mem->tima_reload_delay = 1;
+        } else {
+            mem->io[0x05]++;
+        }
+    }
+}
+
 /*
 mem_timer_update
 
 Advance DIV/TIMA by [cycles], handle TIMA overflow and delayed reload.
+TIMA increments once per falling edge of the selected DIV bit, so stretches without
+an overflow are advanced in closed form. Only the cycle after an overflow, where
+the delayed reload happens, is stepped individually.
 */
 void mem_timer_update(Memory *mem, int cycles) {
 
-    for (int i = 0; i < cycles; i++) {
+    while (cycles > 0) {
 
-        // Check delayed reload
+        // The reload cycle
         if (mem->tima_reload_delay) {
-            mem->tima_reload_delay--;
+            mem_timer_step(mem);
+            cycles--;
+            continue;
+        }
 
-            // Reset TIMA to TMA and request timer interrupt
-            if (mem->tima_reload_delay == 0) {
-                mem->io[0x05] = mem->io[0x06];
-                mem->io[0x0F] |= 0x04;
-            }
+        uint32_t div = mem->div_internal;
+        uint8_t tac = mem->io[0x07];
+
+        // Falling edges happen each time DIV counts past a multiple of the period
+        uint32_t edges = 0;
+        uint32_t period = timer_periods[tac & 0x03];
+        if (tac & 0x04) {
+            edges = ((div + cycles) / period) - (div / period);
+        }
+
+        // No overflow: TIMA counts every edge
+        uint32_t to_overflow = 0x100 - mem->io[0x05];
+        if (edges < to_overflow) {
+            mem->io[0x05] += edges;
+            mem->div_internal = div + cycles;
+            mem->io[0x04] = mem->div_internal >> 8;
+            return;
         }
 
-        // DIV register
-        uint16_t old_div = mem->div_internal;
-        mem->div_internal++;
+        // Run up to the edge that overflows TIMA
+        int overflow = (int)((period - (div & (period - 1))) + (to_overflow - 1) * period);
+        mem->div_internal = div + overflow;
         mem->io[0x04] = mem->div_internal >> 8;
+        mem->io[0x05] = 0x00;
+        mem->tima_reload_delay = 1;
+        cycles -= overflow;
+    }
+}
 
-        // Check if timer is enabled
-        uint8_t tac = mem->io[0x07];
-        if (tac & 0x04) {
+/*
+mem_timer_sync
+
+Bring DIV and TIMA up to the master clock.
+*/
+void mem_timer_sync(Memory *mem) {
+    uint64_t now = mem->gb->scheduler.now;
+
+    if (now != mem->timer_synced) {
+        mem_timer_update(mem, (int)(now - mem->timer_synced));
+        mem->timer_synced = now;
+    }
+}
+
+/*
+mem_timer_schedule
+
+Register the next timer deadline: the cycle the timer requests an interrupt, or a
+periodic resync while it is stopped so the cycles left to catch up stay bounded.
+The timer must be in sync.
+*/
+void mem_timer_schedule(Memory *mem) {
+    int cycles = mem_timer_cycles_to_irq(mem);
+    if (cycles > TIMER_RESYNC_CYCLES) {
+        cycles = TIMER_RESYNC_CYCLES;
+    }
+
+    scheduler_schedule(&mem->gb->scheduler, EVENT_TIMER, mem->timer_synced + cycles);
+}
+
+/*
+mem_timer_event
+
+Handle a timer deadline: catch the timer up, which requests the interrupt if TIMA
+was reloaded, and register the next deadline.
+*/
+void mem_timer_event(Memory *mem) {
+    mem_timer_sync(mem);
+    mem_timer_schedule(mem);
+}
+
+/*
+mem_serial_event
+
+Shift one bit of a serial transfer, due at the cycle [time]. With no link partner,
+1s are shifted in. After eight bits the transfer ends and, with the internal clock,
+requests an interrupt.
+*/
+void mem_serial_event(Memory *mem, uint64_t time) {
+    mem->io[0x01] = (mem->io[0x01] << 1) | 1;
+
+    if (++mem->serial_bits < 8) {
+        scheduler_schedule(&mem->gb->scheduler, EVENT_SERIAL, time + SERIAL_BIT_CYCLES);
+        return;
+    }
+
+    mem->io[0x02] &= ~0x80;
+    mem->serial_bits = 0;
+
+    if (mem->io[0x02] & 0x01) {
+        mem->io[0x0F] |= 0x08;
+    }
+}
+
+/*
+io_read_joypad
+
+Return JOYP (FF00) with the selected button group's state in the low nibble.
+*/
+static uint8_t io_read_joypad(Memory *mem, uint16_t addr) {
+    (void)addr;
+    uint8_t select = mem->io[0x00] & 0x30;
+    uint8_t result = 0xCF;
+
+    if (!(select & 0x10)) {
+        // D-pad selected
+        result &= (mem->gb->joypad_state & 0x0F) | 0xF0;
+    }
+    if (!(select & 0x20)) {
+        // Buttons selected
+        result &= ((mem->gb->joypad_state >> 4) & 0x0F) | 0xF0;
+    }
+
+    return result;
+}
+
+/*
+io_write_joypad
+
+Write JOYP (FF00). Only bits 4 and 5 are writable.
+*/
+static void io_write_joypad(Memory *mem, uint16_t addr, uint8_t value) {
+    (void)addr;
+    mem->io[0x00] = (mem->io[0x00] & 0xCF) | (value & 0x30);
+}
+
+/*
+io_write_serial_control
+
+Write SC (FF02). Starting a transfer schedules its first bit.
+*/
+static void io_write_serial_control(Memory *mem, uint16_t addr, uint8_t value) {
+    (void)addr;
+    mem->io[0x02] = value;
+    mem->serial_bits = 0;
+    if (value & 0x80) {
+        scheduler_schedule(&mem->gb->scheduler, EVENT_SERIAL, mem->gb->scheduler.now + SERIAL_BIT_CYCLES);
+    } else {
+        scheduler_cancel(&mem->gb->scheduler, EVENT_SERIAL);
+    }
+}
+
+/*
+io_read_timer
+
+Return DIV or TIMA, which are only brought up to date when read.
+*/
+static uint8_t io_read_timer(Memory *mem, uint16_t addr) {
+    mem_timer_sync(mem);
+    return mem->io[addr - 0xFF00];
+}
+
+/*
+io_write_timer
+
+Write a timer register (FF04–FF07). The timer is caught up before the write, and
+its deadline moved after it.
+*/
+static void io_write_timer(Memory *mem, uint16_t addr, uint8_t value) {
+    mem_timer_sync(mem);
+
+    // Writing to FF04 resets DIV
+    if (addr == 0xFF04) {
+        mem->div_internal = 0;
+        mem->io[0x04] = 0;
+    } else {
+        mem->io[addr - 0xFF00] = value;
+    }
+
+    mem_timer_schedule(mem);
+}
+
+/*
+io_read_if
 
-            // Check which bit to test falling edge of
-            int bit;
-            switch (tac & 0x03) {
-            case 0:
-                bit = 9;
-                break;
-            case 1:
-                bit = 3;
-                break;
-            case 2:
-                bit = 5;
-                break;
-            case 3:
-                bit = 7;
-                break;
-            }
-
-            int old_bit = (old_div >> bit) & 1;
-            int new_bit = (mem->div_internal >> bit) & 1;
-
-            // Increment TIMA on falling edge of bit, and prepare for timer interrupt on overflow
-            if (old_bit && !new_bit) {
-                if (mem->io[0x05] == 0xFF) {
-                    mem->io[0x05] = 0x00;
-                    mem->tima_reload_delay = 1;
-                } else {
-                    mem->io[0x05]++;
-                }
-            }
+Return IF (FF0F). Bits 5-7 always read 1.
+*/
+static uint8_t io_read_if(Memory *mem, uint16_t addr) {
+    (void)addr;
+    return mem_read_if(mem);
+}
+
+/*
+io_write_if
+
+Write IF (FF0F), keeping bits 5-7 set.
+*/
+static void io_write_if(Memory *mem, uint16_t addr, uint8_t value) {
+    (void)addr;
+    mem->io[0x0F] = 0xE0 | value;
+}
+
+/*
+io_read_ppu
+
+Return an LCD / PPU register, catching the PPU up first.
+*/
+static uint8_t io_read_ppu(Memory *mem, uint16_t addr) {
+    ppu_sync(mem->gb->ppu, mem);
+    return mem->io[addr - 0xFF00];
+}
+
+/*
+io_write_ppu
+
+Write an LCD / PPU register.
+*/
+static void io_write_ppu(Memory *mem, uint16_t addr, uint8_t value) {
+    ppu_write_register(mem->gb->ppu, mem, addr, value);
+}
+
+/*
+io_write_dma
+
+Write DMA (FF46), starting a transfer of 160 bytes from [value] * 0x100 to OAM that
+completes DMA_CYCLES later. Until then the page table is empty, so every CPU access
+takes the slow path, which only lets accesses to FF00–FFFF through. Code outside
+HRAM is not run from the block cache meanwhile. Writing again restarts the transfer.
+*/
+static void io_write_dma(Memory *mem, uint16_t addr, uint8_t value) {
+    Scheduler *sched = &mem->gb->scheduler;
+    mem->io[addr - 0xFF00] = value;
+
+    if (!mem->dma_active) {
+        memcpy(mem->saved_read_page, mem->read_page, sizeof(mem->read_page));
+        memcpy(mem->saved_write_page, mem->write_page, sizeof(mem->write_page));
+        memset(mem->read_page, 0, sizeof(mem->read_page));
+        memset(mem->write_page, 0, sizeof(mem->write_page));
+        mem->dma_active = 1;
+        mem->gb->cpu->block_cache.current = NULL;
+    }
+
+    mem->dma_source = value;
+    scheduler_schedule(sched, EVENT_DMA, sched->now + DMA_CYCLES);
+}
+
+/*
+mem_dma_event
+
+Complete an OAM DMA transfer: give the bus back to the CPU and copy the source page
+to OAM. Sources E0–FF read the WRAM echo below them. The copy is a single memcpy
+from the source page, or a byte loop if the page has side effects and no host pointer.
+*/
+void mem_dma_event(Memory *mem) {
+    memcpy(mem->read_page, mem->saved_read_page, sizeof(mem->read_page));
+    memcpy(mem->write_page, mem->saved_write_page, sizeof(mem->write_page));
+    mem->dma_active = 0;
+
+    ppu_sync(mem->gb->ppu, mem);
+
+    uint8_t page = (mem->dma_source >= 0xE0) ? mem->dma_source - 0x20 : mem->dma_source;
+    const uint8_t *source = mem->read_page[page];
+    if (source) {
+        memcpy(mem->oam, source, OAM_SIZE);
+    } else {
+        for (int i = 0; i < OAM_SIZE; i++) {
+            mem->oam[i] = mem_read_slow(mem, (page << 8) | i);
         }
     }
+    ppu_oam_written(mem->gb->ppu);
+}
+
+const io_read_fn io_read_table[IO_REGISTERS_SIZE] = {
+    [0x00] = io_read_joypad,
+    [0x04] = io_read_timer,
+    [0x05] = io_read_timer,
+    [0x0F] = io_read_if,
+    [0x40] = io_read_ppu,
+    [0x41] = io_read_ppu,
+    [0x42] = io_read_ppu,
+    [0x43] = io_read_ppu,
+    [0x44] = io_read_ppu,
+    [0x45] = io_read_ppu,
+    [0x46] = io_read_ppu,
+    [0x47] = io_read_ppu,
+    [0x48] = io_read_ppu,
+    [0x49] = io_read_ppu,
+    [0x4A] = io_read_ppu,
+    [0x4B] = io_read_ppu,
+};
+
+const io_write_fn io_write_table[IO_REGISTERS_SIZE] = {
+    [0x00] = io_write_joypad,
+    [0x02] = io_write_serial_control,
+    [0x04] = io_write_timer,
+    [0x05] = io_write_timer,
+    [0x06] = io_write_timer,
+    [0x07] = io_write_timer,
+    [0x0F] = io_write_if,
+    [0x40] = io_write_ppu,
+    [0x41] = io_write_ppu,
+    [0x42] = io_write_ppu,
+    [0x43] = io_write_ppu,
+    [0x44] = io_write_ppu,
+    [0x45] = io_write_ppu,
+    [0x46] = io_write_dma,
+    [0x47] = io_write_ppu,
+    [0x48] = io_write_ppu,
+    [0x49] = io_write_ppu,
+    [0x4A] = io_write_ppu,
+    [0x4B] = io_write_ppu,
+};
+
+/*
+mem_timer_cycles_to_irq
+
+Return the number of cycles until the timer can next request an interrupt,
+or INT_MAX if the timer is stopped.
+*/
+int mem_timer_cycles_to_irq(Memory *mem) {
+
+    // A pending reload requests the interrupt on the next cycle
+    if (mem->tima_reload_delay) {
+        return mem->tima_reload_delay;
+    }
+
+    uint8_t tac = mem->io[0x07];
+    if (!(tac & 0x04)) {
+        return INT_MAX;
+    }
+
+    // TIMA increments each time DIV counts past a multiple of the period
+    int period = timer_periods[tac & 0x03];
+    int first = period - (mem->div_internal & (period - 1));
+
+    // Overflow happens (0xFF - TIMA) increments after the first, and the interrupt one cycle later
+    return first + (0xFF - mem->io[0x05]) * period + 1;
 }
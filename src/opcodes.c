@@ -57,10 +57,7 @@ Compare the 8-bit register a to [src].
 Flags: Z 1 H CY
 */
 static inline void op_cp(CPU *cpu, uint8_t src) {
-    set_flag(cpu, FLAG_Z, cpu->a == src);
-    set_flag(cpu, FLAG_N, 1);
-    set_flag(cpu, FLAG_H, (cpu->a & 0x0F) < (src & 0x0F));
-    set_flag(cpu, FLAG_C, (cpu->a) < src);
+    record_flags(cpu, FLAG_OP_SUB, cpu->a, src, 0);
 }
 
 /*
@@ -73,9 +70,7 @@ static inline void op_dec_r(CPU *cpu, uint8_t *src) {
     uint8_t old = *src;
     uint8_t res = old - 1;
     *src = res;
-    set_flag(cpu, FLAG_Z, res == 0);
-    set_flag(cpu, FLAG_N, 1);
-    set_flag(cpu, FLAG_H, (old & 0x0F) == 0);
+    record_flags(cpu, FLAG_OP_DEC, res, 0, lazy_carry(cpu));
 }
 
 /*
@@ -88,9 +83,7 @@ static inline void op_inc_r(CPU *cpu, uint8_t *src) {
     uint8_t old = *src;
     uint8_t res = old + 1;
     *src = res;
-    set_flag(cpu, FLAG_Z, res == 0);
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_H, (old & 0x0F) + 1 > 0x0F);
+    record_flags(cpu, FLAG_OP_INC, res, 0, lazy_carry(cpu));
 }
 
 /*
@@ -137,11 +130,7 @@ Flags: Z 0 0 0
 */
 static inline void op_or(CPU *cpu, uint8_t src) {
     cpu->a |= src;
-
-    set_flag(cpu, FLAG_Z, cpu->a == 0);
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_H, 0);
-    set_flag(cpu, FLAG_C, 0);
+    record_flags(cpu, FLAG_OP_OR, cpu->a, 0, 0);
 }
 
 /*
@@ -152,11 +141,7 @@ Flags: Z 0 1 0
 */
 static inline void op_and(CPU *cpu, uint8_t src) {
     cpu->a &= src;
-
-    set_flag(cpu, FLAG_Z, cpu->a == 0);
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_H, 1);
-    set_flag(cpu, FLAG_C, 0);
+    record_flags(cpu, FLAG_OP_AND, cpu->a, 0, 0);
 }
 
 /*
@@ -167,11 +152,7 @@ Flags: Z 0 0 0
 */
 static inline void op_xor(CPU *cpu, uint8_t src) {
     cpu->a ^= src;
-
-    set_flag(cpu, FLAG_Z, cpu->a == 0);
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_C, 0);
-    set_flag(cpu, FLAG_H, 0);
+    record_flags(cpu, FLAG_OP_OR, cpu->a, 0, 0);
 }
 
 /*
@@ -184,11 +165,7 @@ static inline void op_sub(CPU *cpu, uint8_t src) {
     uint8_t a = cpu->a;
 
     cpu->a = a - src;
-
-    set_flag(cpu, FLAG_Z, cpu->a == 0);
-    set_flag(cpu, FLAG_N, 1);
-    set_flag(cpu, FLAG_H, (a & 0x0F) < (src & 0x0F));
-    set_flag(cpu, FLAG_C, a < src);
+    record_flags(cpu, FLAG_OP_SUB, a, src, 0);
 }
 
 /*
@@ -228,11 +205,7 @@ static inline void op_sbc(CPU *cpu, uint8_t src) {
     uint8_t carry = get_flag(cpu, FLAG_C);
 
     cpu->a -= src + carry;
-
-    set_flag(cpu, FLAG_Z, cpu->a == 0);
-    set_flag(cpu, FLAG_N, 1);
-    set_flag(cpu, FLAG_H, (a & 0x0F) < ((src & 0x0F) + carry));
-    set_flag(cpu, FLAG_C, a < (src + carry));
+    record_flags(cpu, FLAG_OP_SUB, a, src, carry);
 }
 
 /*
@@ -246,11 +219,7 @@ static inline void op_adc(CPU *cpu, uint8_t src) {
     uint8_t carry = get_flag(cpu, FLAG_C);
 
     cpu->a += src + carry;
-
-    set_flag(cpu, FLAG_Z, cpu->a == 0);
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_H, ((a & 0x0F) + (src & 0x0F) + carry) > 0x0F);
-    set_flag(cpu, FLAG_C, a + src + carry > 0xFF);
+    record_flags(cpu, FLAG_OP_ADD, a, src, carry);
 }
 
 /*
@@ -263,11 +232,7 @@ static inline void op_add(CPU *cpu, uint8_t src) {
     uint8_t a = cpu->a;
 
     cpu->a += src;
-
-    set_flag(cpu, FLAG_Z, cpu->a == 0);
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_H, ((a & 0x0F) + (src & 0x0F)) > 0x0F);
-    set_flag(cpu, FLAG_C, a + src > 0xFF);
+    record_flags(cpu, FLAG_OP_ADD, a, src, 0);
 }
 
 /*
@@ -279,10 +244,7 @@ Flags: - 0 H CY
 static inline void op_add_16(CPU *cpu, uint16_t src) {
     uint16_t hl = get_hl(cpu);
     set_hl(cpu, get_hl(cpu) + src);
-
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_H, ((hl & 0x0FFF) + (src & 0x0FFF)) > 0x0FFF);
-    set_flag(cpu, FLAG_C, hl + src > 0xFFFF);
+    record_flags(cpu, FLAG_OP_ADD16, hl, src, lazy_zero(cpu));
 }
 
 /*
@@ -343,10 +305,7 @@ static inline uint8_t op_07(CPU *cpu, Memory *mem) {
     uint8_t msb = (cpu->a & 0x80) >> 7;
     cpu->a = (cpu->a << 1) | msb;
 
-    set_flag(cpu, FLAG_Z, 0);
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_H, 0);
-    set_flag(cpu, FLAG_C, msb);
+    set_flags(cpu, 0, 0, 0, msb);
 
     return 4;
 }
@@ -405,10 +364,7 @@ static inline uint8_t op_0F(CPU *cpu, Memory *mem) {
     uint8_t lsb = cpu->a & 0x01;
     cpu->a = (cpu->a >> 1) | (lsb << 7);
 
-    set_flag(cpu, FLAG_Z, 0);
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_H, 0);
-    set_flag(cpu, FLAG_C, lsb);
+    set_flags(cpu, 0, 0, 0, lsb);
 
     return 4;
 }
@@ -457,10 +413,7 @@ static inline uint8_t op_17(CPU *cpu, Memory *mem) {
     (void)mem;
     uint8_t old = cpu->a;
     cpu->a = (old << 1) | get_flag(cpu, FLAG_C);
-    set_flag(cpu, FLAG_C, old & 0x80);
-    set_flag(cpu, FLAG_Z, 0);
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_H, 0);
+    set_flags(cpu, 0, 0, 0, old & 0x80);
     return 4;
 }
 
@@ -514,10 +467,7 @@ static inline uint8_t op_1F(CPU *cpu, Memory *mem) {
     (void)mem;
     uint8_t old = cpu->a;
     cpu->a = (old >> 1) | (get_flag(cpu, FLAG_C) << 7);
-    set_flag(cpu, FLAG_C, old & 0x01);
-    set_flag(cpu, FLAG_Z, 0);
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_H, 0);
+    set_flags(cpu, 0, 0, 0, old & 0x01);
     return 4;
 }
 
@@ -1114,8 +1064,8 @@ static inline uint8_t op_75(CPU *cpu, Memory *mem) {
 static inline uint8_t op_76(CPU *cpu, Memory *mem) {
     cpu->halted = 1;
 
-    uint8_t IE = mem_read8(mem, 0xFFFF);
-    uint8_t IF = mem_read8(mem, 0xFF0F);
+    uint8_t IE = mem_read_ie(mem);
+    uint8_t IF = mem_read_if(mem);
 
     cpu->halt_bug = (!cpu->ime && (IE & IF));
     return 4;
@@ -1854,11 +1804,7 @@ static inline uint8_t op_E8(CPU *cpu, Memory *mem) {
     uint8_t sp_lo = sp & 0xFF;
     uint8_t u = (uint8_t)src;
 
-    set_flag(cpu, FLAG_Z, 0);
-    set_flag(cpu, FLAG_N, 0);
-
-    set_flag(cpu, FLAG_H, ((sp_lo & 0x0F) + (u & 0x0F)) > 0x0F);
-    set_flag(cpu, FLAG_C, (sp_lo + u) > 0xFF);
+    set_flags(cpu, 0, 0, ((sp_lo & 0x0F) + (u & 0x0F)) > 0x0F, (sp_lo + u) > 0xFF);
 
     return 16;
 }
@@ -1945,12 +1891,9 @@ static inline uint8_t op_F8(CPU *cpu, Memory *mem) {
     uint16_t result = sp + offset;
 
     set_hl(cpu, result);
-    set_flag(cpu, FLAG_Z, 0);
-    set_flag(cpu, FLAG_N, 0);
 
     uint16_t uoff = (uint16_t)(int16_t)offset;
-    set_flag(cpu, FLAG_H, ((sp & 0x0F) + (uoff & 0x0F)) > 0x0F);
-    set_flag(cpu, FLAG_C, ((sp & 0xFF) + (uoff & 0xFF)) > 0xFF);
+    set_flags(cpu, 0, 0, ((sp & 0x0F) + (uoff & 0x0F)) > 0x0F, ((sp & 0xFF) + (uoff & 0xFF)) > 0xFF);
 
     return 12;
 }
@@ -2005,10 +1948,7 @@ Flags: Z 0 0 src.7
 static inline uint8_t cb_rlc(CPU *cpu, uint8_t src) {
     uint8_t result = (src << 1) | (src >> 7);
 
-    set_flag(cpu, FLAG_Z, result == 0);
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_H, 0);
-    set_flag(cpu, FLAG_C, src & 0x80);
+    set_flags(cpu, result == 0, 0, 0, src & 0x80);
     return result;
 }
 
@@ -2021,10 +1961,7 @@ Flags: Z 0 0 src.0
 static inline uint8_t cb_rrc(CPU *cpu, uint8_t src) {
     uint8_t result = (src << 7) | (src >> 1);
 
-    set_flag(cpu, FLAG_Z, result == 0);
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_H, 0);
-    set_flag(cpu, FLAG_C, src & 0x01);
+    set_flags(cpu, result == 0, 0, 0, src & 0x01);
     return result;
 }
 
@@ -2040,10 +1977,7 @@ void cb_rl(CPU *cpu, uint8_t *src) {
 
     *src = (*src << 1) | old_carry;
 
-    set_flag(cpu, FLAG_Z, *src == 0);
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_H, 0);
-    set_flag(cpu, FLAG_C, new_carry);
+    set_flags(cpu, *src == 0, 0, 0, new_carry);
 }
 
 /*
@@ -2058,10 +1992,7 @@ void cb_rr(CPU *cpu, uint8_t *src) {
 
     *src = (old_carry << 7) | (*src >> 1);
 
-    set_flag(cpu, FLAG_Z, *src == 0);
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_H, 0);
-    set_flag(cpu, FLAG_C, new_carry);
+    set_flags(cpu, *src == 0, 0, 0, new_carry);
 }
 
 /*
@@ -2074,10 +2005,7 @@ void cb_sla(CPU *cpu, uint8_t *src) {
     uint8_t msb = (*src & 0x80) >> 7;
     *src <<= 1;
 
-    set_flag(cpu, FLAG_Z, *src == 0);
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_H, 0);
-    set_flag(cpu, FLAG_C, msb);
+    set_flags(cpu, *src == 0, 0, 0, msb);
 }
 
 /*
@@ -2092,10 +2020,7 @@ void cb_sra(CPU *cpu, uint8_t *src) {
 
     *src = msb | (*src >> 1);
 
-    set_flag(cpu, FLAG_Z, *src == 0);
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_H, 0);
-    set_flag(cpu, FLAG_C, lsb);
+    set_flags(cpu, *src == 0, 0, 0, lsb);
 }
 
 /*
@@ -2107,10 +2032,7 @@ Flags: Z 0 0 0
 void cb_swap(CPU *cpu, uint8_t *src) {
     *src = (*src & 0xF0) >> 4 | (*src & 0x0F) << 4;
 
-    set_flag(cpu, FLAG_Z, *src == 0);
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_H, 0);
-    set_flag(cpu, FLAG_C, 0);
+    set_flags(cpu, *src == 0, 0, 0, 0);
 }
 
 /*
@@ -2123,10 +2045,7 @@ void cb_srl(CPU *cpu, uint8_t *src) {
     uint8_t lsb = *src & 0x01;
     *src >>= 1;
 
-    set_flag(cpu, FLAG_Z, *src == 0);
-    set_flag(cpu, FLAG_N, 0);
-    set_flag(cpu, FLAG_H, 0);
-    set_flag(cpu, FLAG_C, lsb);
+    set_flags(cpu, *src == 0, 0, 0, lsb);
 }
 
 /*
@@ -4070,44 +3989,194 @@ static inline uint8_t cb_FF(CPU *cpu, Memory *mem) {
 =================================
 */
 
-opcode_fn opcode_table[NUM_OPCODES] = {
-    op_00, op_01, op_02, op_03, op_04, op_05, op_06, op_07, op_08, op_09, op_0A, op_0B, op_0C,
-    op_0D, op_0E, op_0F, op_00, op_11, op_12, op_13, op_14, op_15, op_16, op_17, op_18, op_19,
-    op_1A, op_1B, op_1C, op_1D, op_1E, op_1F, op_20, op_21, op_22, op_23, op_24, op_25, op_26,
-    op_27, op_28, op_29, op_2A, op_2B, op_2C, op_2D, op_2E, op_2F, op_30, op_31, op_32, op_33,
-    op_34, op_35, op_36, op_37, op_38, op_39, op_3A, op_3B, op_3C, op_3D, op_3E, op_3F, op_40,
-    op_41, op_42, op_43, op_44, op_45, op_46, op_47, op_48, op_49, op_4A, op_4B, op_4C, op_4D,
-    op_4E, op_4F, op_50, op_51, op_52, op_53, op_54, op_55, op_56, op_57, op_58, op_59, op_5A,
-    op_5B, op_5C, op_5D, op_5E, op_5F, op_60, op_61, op_62, op_63, op_64, op_65, op_66, op_67,
-    op_68, op_69, op_6A, op_6B, op_6C, op_6D, op_6E, op_6F, op_70, op_71, op_72, op_73, op_74,
-    op_75, op_76, op_77, op_78, op_79, op_7A, op_7B, op_7C, op_7D, op_7E, op_7F, op_80, op_81,
-    op_82, op_83, op_84, op_85, op_86, op_87, op_88, op_89, op_8A, op_8B, op_8C, op_8D, op_8E,
-    op_8F, op_90, op_91, op_92, op_93, op_94, op_95, op_96, op_97, op_98, op_99, op_9A, op_9B,
-    op_9C, op_9D, op_9E, op_9F, op_A0, op_A1, op_A2, op_A3, op_A4, op_A5, op_A6, op_A7, op_A8,
-    op_A9, op_AA, op_AB, op_AC, op_AD, op_AE, op_AF, op_B0, op_B1, op_B2, op_B3, op_B4, op_B5,
-    op_B6, op_B7, op_B8, op_B9, op_BA, op_BB, op_BC, op_BD, op_BE, op_BF, op_C0, op_C1, op_C2,
-    op_C3, op_C4, op_C5, op_C6, op_C7, op_C8, op_C9, op_CA, op_00, op_CC, op_CD, op_CE, op_CF,
-    op_D0, op_D1, op_D2, op_00, op_D4, op_D5, op_D6, op_D7, op_D8, op_D9, op_DA, op_00, op_DC,
-    op_00, op_DE, op_DF, op_E0, op_E1, op_E2, op_00, op_00, op_E5, op_E6, op_E7, op_E8, op_E9,
-    op_EA, op_00, op_00, op_00, op_EE, op_EF, op_F0, op_F1, op_F2, op_F3, op_00, op_F5, op_F6,
-    op_F7, op_F8, op_F9, op_FA, op_FB, op_00, op_00, op_FE, op_FF, cb_00, cb_01, cb_02, cb_03,
-    cb_04, cb_05, cb_06, cb_07, cb_08, cb_09, cb_0A, cb_0B, cb_0C, cb_0D, cb_0E, cb_0F, cb_10,
-    cb_11, cb_12, cb_13, cb_14, cb_15, cb_16, cb_17, cb_18, cb_19, cb_1A, cb_1B, cb_1C, cb_1D,
-    cb_1E, cb_1F, cb_20, cb_21, cb_22, cb_23, cb_24, cb_25, cb_26, cb_27, cb_28, cb_29, cb_2A,
-    cb_2B, cb_2C, cb_2D, cb_2E, cb_2F, cb_30, cb_31, cb_32, cb_33, cb_34, cb_35, cb_36, cb_37,
-    cb_38, cb_39, cb_3A, cb_3B, cb_3C, cb_3D, cb_3E, cb_3F, cb_40, cb_41, cb_42, cb_43, cb_44,
-    cb_45, cb_46, cb_47, cb_48, cb_49, cb_4A, cb_4B, cb_4C, cb_4D, cb_4E, cb_4F, cb_50, cb_51,
-    cb_52, cb_53, cb_54, cb_55, cb_56, cb_57, cb_58, cb_59, cb_5A, cb_5B, cb_5C, cb_5D, cb_5E,
-    cb_5F, cb_60, cb_61, cb_62, cb_63, cb_64, cb_65, cb_66, cb_67, cb_68, cb_69, cb_6A, cb_6B,
-    cb_6C, cb_6D, cb_6E, cb_6F, cb_70, cb_71, cb_72, cb_73, cb_74, cb_75, cb_76, cb_77, cb_78,
-    cb_79, cb_7A, cb_7B, cb_7C, cb_7D, cb_7E, cb_7F, cb_80, cb_81, cb_82, cb_83, cb_84, cb_85,
-    cb_86, cb_87, cb_88, cb_89, cb_8A, cb_8B, cb_8C, cb_8D, cb_8E, cb_8F, cb_90, cb_91, cb_92,
-    cb_93, cb_94, cb_95, cb_96, cb_97, cb_98, cb_99, cb_9A, cb_9B, cb_9C, cb_9D, cb_9E, cb_9F,
-    cb_A0, cb_A1, cb_A2, cb_A3, cb_A4, cb_A5, cb_A6, cb_A7, cb_A8, cb_A9, cb_AA, cb_AB, cb_AC,
-    cb_AD, cb_AE, cb_AF, cb_B0, cb_B1, cb_B2, cb_B3, cb_B4, cb_B5, cb_B6, cb_B7, cb_B8, cb_B9,
-    cb_BA, cb_BB, cb_BC, cb_BD, cb_BE, cb_BF, cb_C0, cb_C1, cb_C2, cb_C3, cb_C4, cb_C5, cb_C6,
-    cb_C7, cb_C8, cb_C9, cb_CA, cb_CB, cb_CC, cb_CD, cb_CE, cb_CF, cb_D0, cb_D1, cb_D2, cb_D3,
-    cb_D4, cb_D5, cb_D6, cb_D7, cb_D8, cb_D9, cb_DA, cb_DB, cb_DC, cb_DD, cb_DE, cb_DF, cb_E0,
-    cb_E1, cb_E2, cb_E3, cb_E4, cb_E5, cb_E6, cb_E7, cb_E8, cb_E9, cb_EA, cb_EB, cb_EC, cb_ED,
-    cb_EE, cb_EF, cb_F0, cb_F1, cb_F2, cb_F3, cb_F4, cb_F5, cb_F6, cb_F7, cb_F8, cb_F9, cb_FA,
-    cb_FB, cb_FC, cb_FD, cb_FE, cb_FF};
+// X-macro list of (table index, handler) pairs shared by the function pointer
+// table and the threaded interpreter. Indices 0x100-0x1FF are CB-prefixed.
+#define OPCODE_LIST(X) \
+    X(0x000, op_00) X(0x001, op_01) X(0x002, op_02) X(0x003, op_03) X(0x004, op_04) X(0x005, op_05) \
+    X(0x006, op_06) X(0x007, op_07) X(0x008, op_08) X(0x009, op_09) X(0x00A, op_0A) X(0x00B, op_0B) \
+    X(0x00C, op_0C) X(0x00D, op_0D) X(0x00E, op_0E) X(0x00F, op_0F) X(0x010, op_00) X(0x011, op_11) \
+    X(0x012, op_12) X(0x013, op_13) X(0x014, op_14) X(0x015, op_15) X(0x016, op_16) X(0x017, op_17) \
+    X(0x018, op_18) X(0x019, op_19) X(0x01A, op_1A) X(0x01B, op_1B) X(0x01C, op_1C) X(0x01D, op_1D) \
+    X(0x01E, op_1E) X(0x01F, op_1F) X(0x020, op_20) X(0x021, op_21) X(0x022, op_22) X(0x023, op_23) \
+    X(0x024, op_24) X(0x025, op_25) X(0x026, op_26) X(0x027, op_27) X(0x028, op_28) X(0x029, op_29) \
+    X(0x02A, op_2A) X(0x02B, op_2B) X(0x02C, op_2C) X(0x02D, op_2D) X(0x02E, op_2E) X(0x02F, op_2F) \
+    X(0x030, op_30) X(0x031, op_31) X(0x032, op_32) X(0x033, op_33) X(0x034, op_34) X(0x035, op_35) \
+    X(0x036, op_36) X(0x037, op_37) X(0x038, op_38) X(0x039, op_39) X(0x03A, op_3A) X(0x03B, op_3B) \
+    X(0x03C, op_3C) X(0x03D, op_3D) X(0x03E, op_3E) X(0x03F, op_3F) X(0x040, op_40) X(0x041, op_41) \
+    X(0x042, op_42) X(0x043, op_43) X(0x044, op_44) X(0x045, op_45) X(0x046, op_46) X(0x047, op_47) \
+    X(0x048, op_48) X(0x049, op_49) X(0x04A, op_4A) X(0x04B, op_4B) X(0x04C, op_4C) X(0x04D, op_4D) \
+    X(0x04E, op_4E) X(0x04F, op_4F) X(0x050, op_50) X(0x051, op_51) X(0x052, op_52) X(0x053, op_53) \
+    X(0x054, op_54) X(0x055, op_55) X(0x056, op_56) X(0x057, op_57) X(0x058, op_58) X(0x059, op_59) \
+    X(0x05A, op_5A) X(0x05B, op_5B) X(0x05C, op_5C) X(0x05D, op_5D) X(0x05E, op_5E) X(0x05F, op_5F) \
+    X(0x060, op_60) X(0x061, op_61) X(0x062, op_62) X(0x063, op_63) X(0x064, op_64) X(0x065, op_65) \
+    X(0x066, op_66) X(0x067, op_67) X(0x068, op_68) X(0x069, op_69) X(0x06A, op_6A) X(0x06B, op_6B) \
+    X(0x06C, op_6C) X(0x06D, op_6D) X(0x06E, op_6E) X(0x06F, op_6F) X(0x070, op_70) X(0x071, op_71) \
+    X(0x072, op_72) X(0x073, op_73) X(0x074, op_74) X(0x075, op_75) X(0x076, op_76) X(0x077, op_77) \
+    X(0x078, op_78) X(0x079, op_79) X(0x07A, op_7A) X(0x07B, op_7B) X(0x07C, op_7C) X(0x07D, op_7D) \
+    X(0x07E, op_7E) X(0x07F, op_7F) X(0x080, op_80) X(0x081, op_81) X(0x082, op_82) X(0x083, op_83) \
+    X(0x084, op_84) X(0x085, op_85) X(0x086, op_86) X(0x087, op_87) X(0x088, op_88) X(0x089, op_89) \
+    X(0x08A, op_8A) X(0x08B, op_8B) X(0x08C, op_8C) X(0x08D, op_8D) X(0x08E, op_8E) X(0x08F, op_8F) \
+    X(0x090, op_90) X(0x091, op_91) X(0x092, op_92) X(0x093, op_93) X(0x094, op_94) X(0x095, op_95) \
+    X(0x096, op_96) X(0x097, op_97) X(0x098, op_98) X(0x099, op_99) X(0x09A, op_9A) X(0x09B, op_9B) \
+    X(0x09C, op_9C) X(0x09D, op_9D) X(0x09E, op_9E) X(0x09F, op_9F) X(0x0A0, op_A0) X(0x0A1, op_A1) \
+    X(0x0A2, op_A2) X(0x0A3, op_A3) X(0x0A4, op_A4) X(0x0A5, op_A5) X(0x0A6, op_A6) X(0x0A7, op_A7) \
+    X(0x0A8, op_A8) X(0x0A9, op_A9) X(0x0AA, op_AA) X(0x0AB, op_AB) X(0x0AC, op_AC) X(0x0AD, op_AD) \
+    X(0x0AE, op_AE) X(0x0AF, op_AF) X(0x0B0, op_B0) X(0x0B1, op_B1) X(0x0B2, op_B2) X(0x0B3, op_B3) \
+    X(0x0B4, op_B4) X(0x0B5, op_B5) X(0x0B6, op_B6) X(0x0B7, op_B7) X(0x0B8, op_B8) X(0x0B9, op_B9) \
+    X(0x0BA, op_BA) X(0x0BB, op_BB) X(0x0BC, op_BC) X(0x0BD, op_BD) X(0x0BE, op_BE) X(0x0BF, op_BF) \
+    X(0x0C0, op_C0) X(0x0C1, op_C1) X(0x0C2, op_C2) X(0x0C3, op_C3) X(0x0C4, op_C4) X(0x0C5, op_C5) \
+    X(0x0C6, op_C6) X(0x0C7, op_C7) X(0x0C8, op_C8) X(0x0C9, op_C9) X(0x0CA, op_CA) X(0x0CB, op_00) \
+    X(0x0CC, op_CC) X(0x0CD, op_CD) X(0x0CE, op_CE) X(0x0CF, op_CF) X(0x0D0, op_D0) X(0x0D1, op_D1) \
+    X(0x0D2, op_D2) X(0x0D3, op_00) X(0x0D4, op_D4) X(0x0D5, op_D5) X(0x0D6, op_D6) X(0x0D7, op_D7) \
+    X(0x0D8, op_D8) X(0x0D9, op_D9) X(0x0DA, op_DA) X(0x0DB, op_00) X(0x0DC, op_DC) X(0x0DD, op_00) \
+    X(0x0DE, op_DE) X(0x0DF, op_DF) X(0x0E0, op_E0) X(0x0E1, op_E1) X(0x0E2, op_E2) X(0x0E3, op_00) \
+    X(0x0E4, op_00) X(0x0E5, op_E5) X(0x0E6, op_E6) X(0x0E7, op_E7) X(0x0E8, op_E8) X(0x0E9, op_E9) \
+    X(0x0EA, op_EA) X(0x0EB, op_00) X(0x0EC, op_00) X(0x0ED, op_00) X(0x0EE, op_EE) X(0x0EF, op_EF) \
+    X(0x0F0, op_F0) X(0x0F1, op_F1) X(0x0F2, op_F2) X(0x0F3, op_F3) X(0x0F4, op_00) X(0x0F5, op_F5) \
+    X(0x0F6, op_F6) X(0x0F7, op_F7) X(0x0F8, op_F8) X(0x0F9, op_F9) X(0x0FA, op_FA) X(0x0FB, op_FB) \
+    X(0x0FC, op_00) X(0x0FD, op_00) X(0x0FE, op_FE) X(0x0FF, op_FF) X(0x100, cb_00) X(0x101, cb_01) \
+    X(0x102, cb_02) X(0x103, cb_03) X(0x104, cb_04) X(0x105, cb_05) X(0x106, cb_06) X(0x107, cb_07) \
+    X(0x108, cb_08) X(0x109, cb_09) X(0x10A, cb_0A) X(0x10B, cb_0B) X(0x10C, cb_0C) X(0x10D, cb_0D) \
+    X(0x10E, cb_0E) X(0x10F, cb_0F) X(0x110, cb_10) X(0x111, cb_11) X(0x112, cb_12) X(0x113, cb_13) \
+    X(0x114, cb_14) X(0x115, cb_15) X(0x116, cb_16) X(0x117, cb_17) X(0x118, cb_18) X(0x119, cb_19) \
+    X(0x11A, cb_1A) X(0x11B, cb_1B) X(0x11C, cb_1C) X(0x11D, cb_1D) X(0x11E, cb_1E) X(0x11F, cb_1F) \
+    X(0x120, cb_20) X(0x121, cb_21) X(0x122, cb_22) X(0x123, cb_23) X(0x124, cb_24) X(0x125, cb_25) \
+    X(0x126, cb_26) X(0x127, cb_27) X(0x128, cb_28) X(0x129, cb_29) X(0x12A, cb_2A) X(0x12B, cb_2B) \
+    X(0x12C, cb_2C) X(0x12D, cb_2D) X(0x12E, cb_2E) X(0x12F, cb_2F) X(0x130, cb_30) X(0x131, cb_31) \
+    X(0x132, cb_32) X(0x133, cb_33) X(0x134, cb_34) X(0x135, cb_35) X(0x136, cb_36) X(0x137, cb_37) \
+    X(0x138, cb_38) X(0x139, cb_39) X(0x13A, cb_3A) X(0x13B, cb_3B) X(0x13C, cb_3C) X(0x13D, cb_3D) \
+    X(0x13E, cb_3E) X(0x13F, cb_3F) X(0x140, cb_40) X(0x141, cb_41) X(0x142, cb_42) X(0x143, cb_43) \
+    X(0x144, cb_44) X(0x145, cb_45) X(0x146, cb_46) X(0x147, cb_47) X(0x148, cb_48) X(0x149, cb_49) \
+    X(0x14A, cb_4A) X(0x14B, cb_4B) X(0x14C, cb_4C) X(0x14D, cb_4D) X(0x14E, cb_4E) X(0x14F, cb_4F) \
+    X(0x150, cb_50) X(0x151, cb_51) X(0x152, cb_52) X(0x153, cb_53) X(0x154, cb_54) X(0x155, cb_55) \
+    X(0x156, cb_56) X(0x157, cb_57) X(0x158, cb_58) X(0x159, cb_59) X(0x15A, cb_5A) X(0x15B, cb_5B) \
+    X(0x15C, cb_5C) X(0x15D, cb_5D) X(0x15E, cb_5E) X(0x15F, cb_5F) X(0x160, cb_60) X(0x161, cb_61) \
+    X(0x162, cb_62) X(0x163, cb_63) X(0x164, cb_64) X(0x165, cb_65) X(0x166, cb_66) X(0x167, cb_67) \
+    X(0x168, cb_68) X(0x169, cb_69) X(0x16A, cb_6A) X(0x16B, cb_6B) X(0x16C, cb_6C) X(0x16D, cb_6D) \
+    X(0x16E, cb_6E) X(0x16F, cb_6F) X(0x170, cb_70) X(0x171, cb_71) X(0x172, cb_72) X(0x173, cb_73) \
+    X(0x174, cb_74) X(0x175, cb_75) X(0x176, cb_76) X(0x177, cb_77) X(0x178, cb_78) X(0x179, cb_79) \
+    X(0x17A, cb_7A) X(0x17B, cb_7B) X(0x17C, cb_7C) X(0x17D, cb_7D) X(0x17E, cb_7E) X(0x17F, cb_7F) \
+    X(0x180, cb_80) X(0x181, cb_81) X(0x182, cb_82) X(0x183, cb_83) X(0x184, cb_84) X(0x185, cb_85) \
+    X(0x186, cb_86) X(0x187, cb_87) X(0x188, cb_88) X(0x189, cb_89) X(0x18A, cb_8A) X(0x18B, cb_8B) \
+    X(0x18C, cb_8C) X(0x18D, cb_8D) X(0x18E, cb_8E) X(0x18F, cb_8F) X(0x190, cb_90) X(0x191, cb_91) \
+    X(0x192, cb_92) X(0x193, cb_93) X(0x194, cb_94) X(0x195, cb_95) X(0x196, cb_96) X(0x197, cb_97) \
+    X(0x198, cb_98) X(0x199, cb_99) X(0x19A, cb_9A) X(0x19B, cb_9B) X(0x19C, cb_9C) X(0x19D, cb_9D) \
+    X(0x19E, cb_9E) X(0x19F, cb_9F) X(0x1A0, cb_A0) X(0x1A1, cb_A1) X(0x1A2, cb_A2) X(0x1A3, cb_A3) \
+    X(0x1A4, cb_A4) X(0x1A5, cb_A5) X(0x1A6, cb_A6) X(0x1A7, cb_A7) X(0x1A8, cb_A8) X(0x1A9, cb_A9) \
+    X(0x1AA, cb_AA) X(0x1AB, cb_AB) X(0x1AC, cb_AC) X(0x1AD, cb_AD) X(0x1AE, cb_AE) X(0x1AF, cb_AF) \
+    X(0x1B0, cb_B0) X(0x1B1, cb_B1) X(0x1B2, cb_B2) X(0x1B3, cb_B3) X(0x1B4, cb_B4) X(0x1B5, cb_B5) \
+    X(0x1B6, cb_B6) X(0x1B7, cb_B7) X(0x1B8, cb_B8) X(0x1B9, cb_B9) X(0x1BA, cb_BA) X(0x1BB, cb_BB) \
+    X(0x1BC, cb_BC) X(0x1BD, cb_BD) X(0x1BE, cb_BE) X(0x1BF, cb_BF) X(0x1C0, cb_C0) X(0x1C1, cb_C1) \
+    X(0x1C2, cb_C2) X(0x1C3, cb_C3) X(0x1C4, cb_C4) X(0x1C5, cb_C5) X(0x1C6, cb_C6) X(0x1C7, cb_C7) \
+    X(0x1C8, cb_C8) X(0x1C9, cb_C9) X(0x1CA, cb_CA) X(0x1CB, cb_CB) X(0x1CC, cb_CC) X(0x1CD, cb_CD) \
+    X(0x1CE, cb_CE) X(0x1CF, cb_CF) X(0x1D0, cb_D0) X(0x1D1, cb_D1) X(0x1D2, cb_D2) X(0x1D3, cb_D3) \
+    X(0x1D4, cb_D4) X(0x1D5, cb_D5) X(0x1D6, cb_D6) X(0x1D7, cb_D7) X(0x1D8, cb_D8) X(0x1D9, cb_D9) \
+    X(0x1DA, cb_DA) X(0x1DB, cb_DB) X(0x1DC, cb_DC) X(0x1DD, cb_DD) X(0x1DE, cb_DE) X(0x1DF, cb_DF) \
+    X(0x1E0, cb_E0) X(0x1E1, cb_E1) X(0x1E2, cb_E2) X(0x1E3, cb_E3) X(0x1E4, cb_E4) X(0x1E5, cb_E5) \
+    X(0x1E6, cb_E6) X(0x1E7, cb_E7) X(0x1E8, cb_E8) X(0x1E9, cb_E9) X(0x1EA, cb_EA) X(0x1EB, cb_EB) \
+    X(0x1EC, cb_EC) X(0x1ED, cb_ED) X(0x1EE, cb_EE) X(0x1EF, cb_EF) X(0x1F0, cb_F0) X(0x1F1, cb_F1) \
+    X(0x1F2, cb_F2) X(0x1F3, cb_F3) X(0x1F4, cb_F4) X(0x1F5, cb_F5) X(0x1F6, cb_F6) X(0x1F7, cb_F7) \
+    X(0x1F8, cb_F8) X(0x1F9, cb_F9) X(0x1FA, cb_FA) X(0x1FB, cb_FB) X(0x1FC, cb_FC) X(0x1FD, cb_FD) \
+    X(0x1FE, cb_FE) X(0x1FF, cb_FF)
+
+#define OPCODE_TABLE_ENTRY(index, handler) handler,
+
+opcode_fn opcode_table[NUM_OPCODES] = {OPCODE_LIST(OPCODE_TABLE_ENTRY)};
+
+/*
+=================================
+   THREADED INTERPRETER START
+=================================
+*/
+
+#if CPU_THREADED_DISPATCH
+
+// Use GCC/Clang labels-as-values where available, otherwise fall back to a switch
+#if defined(__GNUC__)
+#define THREADED_COMPUTED_GOTO 1
+#define THREADED_LABEL_ADDRESS(index, handler) &&target_##index,
+#define TARGET(index) target_##index:
+#define DISPATCH() goto *dispatch_table[index]
+#else
+#define THREADED_COMPUTED_GOTO 0
+#define TARGET(index) case index:
+#define DISPATCH() goto dispatch
+#endif
+
+// Fast-forward idle loops and run hot blocks natively, then restart at the instruction boundary
+#define BLOCK_BOUNDARY()                                                                           \
+    if (cpu_block_boundary(cpu, mem)) {                                                            \
+        goto instruction_boundary;                                                                 \
+    }
+
+// Finish the current instruction, then fetch and jump straight to the next one.
+// Halt, interrupts and the end of the frame are handled out of line.
+#define NEXT_INSTRUCTION()                                                                         \
+    do {                                                                                           \
+        tick(cpu, cycles);                                                                         \
+        check_ei_delay(cpu);                                                                       \
+        if (cpu->frame_cycles <= 0 || cpu->halted || cpu_interrupt_pending(cpu, mem)) {            \
+            goto instruction_boundary;                                                             \
+        }                                                                                          \
+        BLOCK_BOUNDARY();                                                                          \
+        index = cpu_fetch(cpu, mem)->index;                                                        \
+        DISPATCH();                                                                                \
+    } while (0)
+
+#define THREADED_INSTRUCTION(index, handler)                                                       \
+    TARGET(index) {                                                                                \
+        cycles = handler(cpu, mem);                                                                \
+        NEXT_INSTRUCTION();                                                                        \
+    }
+
+/*
+opcode_run_threaded
+
+Execute instructions until the frame cycle budget is used up. Behaves exactly like
+repeated calls to cpu_step, but each handler is inlined at its own label and ends
+with its own dispatch, so there is no call/return and no shared indirect branch.
+*/
+void opcode_run_threaded(CPU *cpu, Memory *mem) {
+#if THREADED_COMPUTED_GOTO
+    static const void *const dispatch_table[NUM_OPCODES] = {OPCODE_LIST(THREADED_LABEL_ADDRESS)};
+#endif
+
+    uint16_t index;
+    uint8_t cycles;
+
+instruction_boundary:
+    if (cpu->frame_cycles <= 0) {
+        return;
+    }
+
+    // CPU halt logic
+    if (cpu->halted) {
+        if (!(mem_read_ie(mem) & mem_read_if(mem))) {
+            tick(cpu, cpu_halt_cycles(cpu, mem));
+            check_ei_delay(cpu);
+            goto instruction_boundary;
+        }
+
+        cpu->halted = 0;
+    }
+
+    // Check for interrupts
+    cpu_handle_interrupts(cpu, mem);
+
+    BLOCK_BOUNDARY();
+    index = cpu_fetch(cpu, mem)->index;
+    DISPATCH();
+
+#if !THREADED_COMPUTED_GOTO
+dispatch:
+    switch (index) {
+#endif
+
+    OPCODE_LIST(THREADED_INSTRUCTION)
+
+#if !THREADED_COMPUTED_GOTO
+    }
+#endif
+}
+
+#endif
@@ -1,21 +1,15 @@
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "config.h"
 #include "memory.h"
 #include "ppu.h"
+#include "render.h"
 
 const uint32_t palettes[NUM_PALETTES][6] = {{PALETTE_0}, {PALETTE_1}, {PALETTE_2}, {PALETTE_3}, {PALETTE_4}, {PALETTE_5}};
 
-/*
-gb_palette
-
-Map a 2-bit colour index to an RGB pixel using the active palette.
-*/
-static inline uint32_t gb_palette(uint8_t palette_id, uint8_t colour) {
-    return palettes[palette_id][colour & 3];
-}
-
 /*
 ppu_update_stat
 
@@ -65,48 +59,63 @@ static inline void ppu_update_stat(PPU *ppu, Memory *mem) {
 }
 
 /*
-ppu_read_tile_pixel
+ppu_decode_tile
 
-Return the 2-bit colour for a background/window pixel at [x, y].
+Decode tile [tile] from VRAM into the tile cache, as stored and X-flipped.
 */
-static inline uint8_t ppu_read_tile_pixel(Memory *mem, int tiledata_unsigned, uint16_t tilemap, uint16_t x, uint16_t y) {
-
-    // Get tile row and column
-    uint16_t tile_row = y >> 3;
-    uint16_t tile_col = x >> 3;
-
-    // Get the index in memory of the pixel
-    uint16_t index_addr = tilemap + (tile_row << 5) + tile_col;
-    uint8_t raw_index = mem_read8(mem, index_addr);
-
-    uint16_t tile_addr = tiledata_unsigned ? (0x8000 + (raw_index << 4)) : (0x9000 + (((int8_t)raw_index) << 4));
+static void ppu_decode_tile(PPU *ppu, Memory *mem, uint16_t tile) {
+    render_decode_tile(&mem->vram[tile << 4], ppu->tiles[tile], ppu->tiles_xflip[tile]);
+    ppu->tile_dirty[tile] = 0;
+}
 
-    // Get colour map of pixel by adding both bitplanes
+/*
+ppu_tile_row
 
-    uint8_t b1 = mem_read8(mem, tile_addr + ((y & 7) << 1));
-    uint8_t b2 = mem_read8(mem, tile_addr + ((y & 7) << 1) + 1);
-    uint8_t bit = 7 - (x & 7);
-    return ((b2 >> bit) & 1) << 1 | ((b1 >> bit) & 1);
+Return the decoded row [y] of tile [tile], X-flipped if [xflip].
+*/
+static inline const uint8_t *ppu_tile_row(PPU *ppu, Memory *mem, uint16_t tile, uint8_t y, bool xflip) {
+    if (ppu->tile_dirty[tile]) {
+        ppu_decode_tile(ppu, mem, tile);
+    }
+    return xflip ? ppu->tiles_xflip[tile][y & 7] : ppu->tiles[tile][y & 7];
 }
 
 /*
-ppu_read_sprite_pixel
+ppu_draw_tile_row
 
-Return the colour of the sprite pixel at [x, y] for a given tile line.
+Write the colour indices of screen pixels [x0, x1) of the current line from tilemap
+[tilemap], where screen pixel x shows map pixel x + [scroll_x] (wrapping at 256) of map
+line [y]. Each tile row is fetched once, and the first and last tiles are cut to the
+fine scroll.
 */
-static inline uint8_t ppu_read_sprite_pixel(Memory *mem, uint16_t tile_addr, uint8_t x, uint8_t y, bool xflip) {
-    x = xflip ? (7 - x) : x;
+static void ppu_draw_tile_row(PPU *ppu, Memory *mem, uint8_t *indices, int x0, int x1, uint16_t tilemap,
+                              bool unsigned_tiles, uint8_t scroll_x, uint8_t y) {
+    const uint8_t *map_row = &mem->vram[tilemap - 0x8000 + ((y >> 3) << 5)];
+
+    int x = x0;
+    while (x < x1) {
+        uint8_t map_x = (uint8_t)(x + scroll_x);
+        uint8_t raw_index = map_row[map_x >> 3];
+
+        // Signed indices count from the tile at 9000
+        uint16_t tile = unsigned_tiles ? raw_index : (uint16_t)(256 + (int8_t)raw_index);
+        const uint8_t *row = ppu_tile_row(ppu, mem, tile, y, false);
+
+        int fine = map_x & 7;
+        int count = 8 - fine;
+        if (count > x1 - x) {
+            count = x1 - x;
+        }
 
-    uint8_t b1 = mem_read8(mem, tile_addr + ((y & 7) << 1));
-    uint8_t b2 = mem_read8(mem, tile_addr + ((y & 7) << 1) + 1);
-    uint8_t bit = 7 - (x & 7);
-    return ((b2 >> bit) & 1) << 1 | ((b1 >> bit) & 1);
+        memcpy(&indices[x], &row[fine], count);
+        x += count;
+    }
 }
 
 /*
 ppu_init
 
-Initialize the PPU and create the SDL window/renderer/texture.
+Initialize the PPU, with no window: frames go to memory until ppu_open_window.
 */
 Status ppu_init(PPU *ppu, GB *gb) {
     if (gb == NULL) {
@@ -114,8 +123,32 @@ Status ppu_init(PPU *ppu, GB *gb) {
     }
     ppu->gb = gb;
 
+    // Pick the pixel kernels for this CPU
+    render_init();
+
+    // Start the frame buffers out blank, with nothing to present yet
+    memset(ppu->frames, 0, sizeof(ppu->frames));
+    ppu->frame_front = 0;
+    SDL_AtomicSet(&ppu->frame_shared, 1);
+    ppu->frame_back = 2;
+
+    // Frames are kept in memory until a window is opened or another presenter is set
+    ppu->window = NULL;
+    ppu->renderer = NULL;
+    ppu->texture = NULL;
+    ppu_set_present(ppu, NULL, NULL);
+
     ppu_reset(ppu);
 
+    return OK;
+}
+
+/*
+ppu_open_window
+
+Create the SDL window, renderer and texture frames are presented with.
+*/
+Status ppu_open_window(PPU *ppu) {
     ppu->window = SDL_CreateWindow("C-GB", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 160 * SCREEN_SCALING, 144 * SCREEN_SCALING, SDL_WINDOW_SHOWN);
     if (!ppu->window) {
         printf("Failed to create window: %s\n", SDL_GetError());
@@ -126,6 +159,7 @@ Status ppu_init(PPU *ppu, GB *gb) {
     if (!ppu->renderer) {
         printf("Failed to create renderer: %s\n", SDL_GetError());
         SDL_DestroyWindow(ppu->window);
+        ppu->window = NULL;
         return ERR_SDL_NOT_INITIALIZED;
     }
 
@@ -134,6 +168,8 @@ Status ppu_init(PPU *ppu, GB *gb) {
         printf("Failed to create texture: %s\n", SDL_GetError());
         SDL_DestroyRenderer(ppu->renderer);
         SDL_DestroyWindow(ppu->window);
+        ppu->renderer = NULL;
+        ppu->window = NULL;
         return ERR_SDL_NOT_INITIALIZED;
     }
 
@@ -155,66 +191,132 @@ void ppu_reset(PPU *ppu) {
     ppu->window_line = 0;
     ppu->window_drawn = 0;
 
+    ppu->skip_next = 0;
+    ppu->skip_frame = 0;
+
     ppu->palette_id = DEFAULT_PALETTE;
+
+    // OAM has been cleared
+    ppu->sprites_dirty = 1;
+
+    // VRAM has been cleared, so decode every tile again
+    memset(ppu->tile_dirty, 1, sizeof(ppu->tile_dirty));
+
+    // Register the first PPU event
+    ppu->synced = ppu->gb->scheduler.now;
+    ppu_schedule(ppu, ppu->gb->mem);
+}
+
+/*
+ppu_window_start
+
+Return the first pixel of the current line covered by the window, or the screen
+width if the window is not on it.
+*/
+static inline int ppu_window_start(PPU *ppu, Memory *mem) {
+    if (!(mem->io[0x40] & 0x20) || ppu->ly < mem->io[0x4A]) {
+        return SCREEN_WIDTH;
+    }
+    int win_x = (int)mem->io[0x4B] - 7;
+    if (win_x < 0) {
+        return 0;
+    }
+    return (win_x < SCREEN_WIDTH) ? win_x : SCREEN_WIDTH;
 }
 
 /*
 ppu_draw_tiles
 
 Render the background/window tiles for the current scanline into the framebuffer.
+The background runs up to WX, where the line switches to the window once.
 */
 static void ppu_draw_tiles(PPU *ppu, Memory *mem) {
 
     // Read registers
-    uint8_t lcdc = mem_read8(mem, 0xFF40);
+    uint8_t lcdc = mem->io[0x40];
     uint8_t ly = ppu->ly;
-    uint8_t scx = mem_read8(mem, 0xFF43);
-    uint8_t scy = mem_read8(mem, 0xFF42);
-    uint8_t wx = mem_read8(mem, 0xFF4B);
-    uint8_t wy = mem_read8(mem, 0xFF4A);
+    uint8_t scx = mem->io[0x43];
+    uint8_t scy = mem->io[0x42];
+    uint8_t wx = mem->io[0x4B];
 
-    // Check for background and window enable bits
+    // Check for background enable bit
     bool bg_enable = lcdc & 0x01;
-    bool win_enable = lcdc & 0x20;
 
     // Check which tilemap to use and whether to use signed or unsigned indexing
     uint16_t bg_map = (lcdc & 0x08) ? 0x9C00 : 0x9800;
     uint16_t win_map = (lcdc & 0x40) ? 0x9C00 : 0x9800;
     bool unsigned_tiles = lcdc & 0x10;
 
-    // Get the colour of each background pixel and update the framebuffer
-    for (uint8_t x = 0; x < SCREEN_WIDTH; x++) {
+    // First pixel covered by the window, or the screen width if none is
+    int win_x = ppu_window_start(ppu, mem);
 
-        uint8_t bg_colour = 0;
+    uint8_t *indices = ppu->bg_indices;
 
-        if (bg_enable) {
-            uint16_t bx = (x + scx) & 0xFF;
-            uint16_t by = (ly + scy) & 0xFF;
-            bg_colour = ppu_read_tile_pixel(mem, unsigned_tiles, bg_map, bx, by);
-        }
+    // Background up to the window
+    if (bg_enable) {
+        ppu_draw_tile_row(ppu, mem, indices, 0, win_x, bg_map, unsigned_tiles, scx, (ly + scy) & 0xFF);
+    } else {
+        memset(indices, 0, win_x);
+    }
 
-        if (win_enable && ly >= wy && x >= (int)wx - 7) {
-            uint16_t wx_x = x - ((int)wx - 7);
-            uint16_t wy_y = ppu->window_line;
-            bg_colour = ppu_read_tile_pixel(mem, unsigned_tiles, win_map, wx_x, wy_y);
-            ppu->window_drawn = 1;
-        }
+    // Window from WX to the end of the line
+    if (win_x < SCREEN_WIDTH) {
+        ppu_draw_tile_row(ppu, mem, indices, win_x, SCREEN_WIDTH, win_map, unsigned_tiles, (uint8_t)(7 - wx),
+                          ppu->window_line);
+        ppu->window_drawn = 1;
+    }
+
+    // Map the whole line through BGP at once
+    render_shade(&ppu->framebuffer[ly * SCREEN_WIDTH], indices, mem->io[0x47], SCREEN_WIDTH);
+}
+
+/*
+ppu_build_sprite_index
 
-        // Check palette
-        uint8_t bgp = mem_read8(mem, 0xFF47);
-        uint8_t mapped_colour = (bgp >> (bg_colour << 1)) & 0x03;
-        ppu->framebuffer[ly * SCREEN_WIDTH + x] = gb_palette(ppu->palette_id, mapped_colour);
+List the sprites on each line for sprites [height] pixels tall: the first 10 OAM
+entries that cover the line, sorted by X and then OAM position.
+*/
+static void ppu_build_sprite_index(PPU *ppu, Memory *mem, uint8_t height) {
+    memset(ppu->line_sprite_count, 0, sizeof(ppu->line_sprite_count));
+
+    for (uint8_t i = 0; i < OAM_SPRITES; i++) {
+        const uint8_t *entry = &mem->oam[i * 4];
+        int top = entry[0] - 16;
+        int first = (top > 0) ? top : 0;
+        int last = (top + height < SCREEN_HEIGHT) ? top + height : SCREEN_HEIGHT;
+
+        for (int ly = first; ly < last; ly++) {
+            uint8_t count = ppu->line_sprite_count[ly];
+            if (count == SPRITES_PER_LINE) {
+                continue;
+            }
+
+            // Insert after entries with a lower or equal X, which come earlier in OAM
+            uint8_t *sprites = ppu->line_sprites[ly];
+            int j = count;
+            while (j > 0 && mem->oam[sprites[j - 1] * 4 + 1] > entry[1]) {
+                sprites[j] = sprites[j - 1];
+                j--;
+            }
+            sprites[j] = i;
+            ppu->line_sprite_count[ly] = count + 1;
+        }
     }
+
+    ppu->sprite_height = height;
+    ppu->sprites_dirty = 0;
 }
 
 /*
 ppu_draw_sprites
 
-Render visible sprites for the current scanline into the framebuffer.
+Render visible sprites for the current scanline into the framebuffer. Each pixel
+takes the highest priority opaque sprite pixel over it, which is hidden if that
+sprite is behind the background and the background colour index there is not 0.
 */
 static void ppu_draw_sprites(PPU *ppu, Memory *mem) {
 
-    uint8_t lcdc = mem_read8(mem, 0xFF40);
+    uint8_t lcdc = mem->io[0x40];
 
     // Check if sprites are enabled
     if (!(lcdc & 0x02)) {
@@ -227,66 +329,42 @@ static void ppu_draw_sprites(PPU *ppu, Memory *mem) {
     bool tall_sprites = lcdc & 0x04;
     uint8_t height = tall_sprites ? 16 : 8;
 
-    // Array for sprites
-    Sprite line_sprites[10];
-
-    // Populate line_sprites array
-    uint8_t drawn = 0;
-    for (uint8_t i = 0; i < 40 && drawn < 10; i++) {
-
-        // Fetch address of sprite in OAM
-        uint16_t addr = 0xFE00 + (i * 4);
-
-        // Fetch remaining sprite attributes
-        int sprite_y = mem_read8(mem, addr) - 16;
-        int sprite_x = mem_read8(mem, addr + 1) - 8;
-        uint8_t tile = mem_read8(mem, addr + 2);
-        uint8_t attr = mem_read8(mem, addr + 3);
-
-        // Check that sprite line is onscreen
-        if (ly < sprite_y || ly >= sprite_y + height) {
-            continue;
-        }
-
-        // Create Sprite and add it to array
-        line_sprites[drawn] = (Sprite){i, sprite_y, sprite_x, tile, attr};
-        drawn++;
+    // Rebuild the sprite index if OAM or the sprite size changed
+    if (ppu->sprites_dirty || ppu->sprite_height != height) {
+        ppu_build_sprite_index(ppu, mem, height);
     }
 
-    // Sort sprites by X-value, then by OAM order
-    for (int i = 0; i < drawn - 1; i++) {
-        for (int j = 0; j < drawn - 1 - i; j++) {
-            Sprite *a = &line_sprites[j];
-            Sprite *b = &line_sprites[j + 1];
-
-            bool swap = (a->x > b->x) || (a->x == b->x && a->index > b->index);
-
-            if (swap) {
-                Sprite tmp = *a;
-                *a = *b;
-                *b = tmp;
-            }
-        }
+    const uint8_t *sprites = ppu->line_sprites[ly];
+    int count = ppu->line_sprite_count[ly];
+    if (!count) {
+        return;
     }
 
-    // Draw all sprites on current line from right to left
-    for (int i = drawn - 1; i >= 0; i--) {
+    // Pixels already taken by a higher priority sprite
+    uint8_t taken[SCREEN_WIDTH];
+    memset(taken, 0, sizeof(taken));
+
+    // Draw all sprites on current line from highest to lowest priority
+    for (int i = 0; i < count; i++) {
 
         // Get sprite attributes
-        Sprite sprite = line_sprites[i];
-        uint8_t priority = sprite.attr & 0x80;
-        uint8_t yflip = sprite.attr & 0x40;
-        uint8_t xflip = sprite.attr & 0x20;
-        uint8_t palette = sprite.attr & 0x10;
+        const uint8_t *entry = &mem->oam[sprites[i] * 4];
+        int sprite_y = entry[0] - 16;
+        int sprite_x = entry[1] - 8;
+        uint8_t attr = entry[3];
+        uint8_t priority = attr & 0x80;
+        uint8_t yflip = attr & 0x40;
+        uint8_t xflip = attr & 0x20;
+        uint8_t palette = attr & 0x10;
 
         // Get sprite palette
-        uint8_t obj_palette = mem_read8(mem, palette ? 0xFF49 : 0xFF48);
+        uint8_t obj_palette = mem->io[palette ? 0x49 : 0x48];
 
         // Get line and apply vertical flip
-        int line = yflip ? (height - 1 - (ly - sprite.y)) : (ly - sprite.y);
+        int line = yflip ? (height - 1 - (ly - sprite_y)) : (ly - sprite_y);
 
         // Get tile index
-        uint16_t tile_index = sprite.tile;
+        uint16_t tile_index = entry[2];
 
         // Handle line of tall sprites
         if (tall_sprites) {
@@ -297,12 +375,12 @@ static void ppu_draw_sprites(PPU *ppu, Memory *mem) {
             }
         }
 
-        // Get address of tile
-        uint16_t tile_addr = 0x8000 + (tile_index << 4);
+        // Get decoded tile line
+        const uint8_t *row = ppu_tile_row(ppu, mem, tile_index, line, xflip);
 
         // Draw sprite line
         for (int x = 0; x < 8; x++) {
-            int pixel_x = sprite.x + x;
+            int pixel_x = sprite_x + x;
 
             // Don't draw off the edge of the screen
             if (pixel_x < 0 || pixel_x >= SCREEN_WIDTH) {
@@ -310,24 +388,21 @@ static void ppu_draw_sprites(PPU *ppu, Memory *mem) {
             }
 
             // Get mapped colour of sprite pixel
-            uint8_t colour = ppu_read_sprite_pixel(mem, tile_addr, x, line, xflip);
+            uint8_t colour = row[x];
 
-            // Don't draw transparent pixels
-            if (colour == 0) {
+            // Don't draw transparent pixels or under a higher priority sprite
+            if (colour == 0 || taken[pixel_x]) {
                 continue;
             }
+            taken[pixel_x] = 1;
 
             // If priority is set, only draw over bg colour 0
-            if (priority) {
-                uint32_t bg = ppu->framebuffer[ly * SCREEN_WIDTH + pixel_x];
-                if (bg != gb_palette(ppu->palette_id, 0)) {
-                    continue;
-                }
+            if (priority && ppu->bg_indices[pixel_x]) {
+                continue;
             }
 
             // Remap colour to obj_palette and update framebuffer
-            uint8_t mapped = (obj_palette >> (colour * 2)) & 3;
-            ppu->framebuffer[ly * SCREEN_WIDTH + pixel_x] = gb_palette(ppu->palette_id, mapped);
+            ppu->framebuffer[ly * SCREEN_WIDTH + pixel_x] = (obj_palette >> (colour * 2)) & 3;
         }
     }
 }
@@ -341,113 +416,166 @@ static inline void ppu_mode_change(PPU *ppu, uint8_t mode) {
     ppu->mode = mode;
 }
 
+/*
+ppu_mode_end
+
+Return the dot at which mode [mode] ends: mode 2 at 80, mode 3 at 252, and HBlank
+and each VBlank line at the end of the scanline.
+*/
+static inline int ppu_mode_end(uint8_t mode) {
+    switch (mode) {
+    case 2:
+        return 80;
+    case 3:
+        return 252;
+    default:
+        return 456;
+    }
+}
+
 /*
 ppu_step
 
 Advance PPU timing by [cycles], handling mode transitions and scanline draw.
+Nothing observable happens between mode boundaries, so the PPU jumps from one
+boundary to the next.
 */
 void ppu_step(PPU *ppu, Memory *mem, int cycles) {
 
-    // Emulate one cycle at a time
-    while (cycles--) {
+    // If LCDC bit 7 is clear, PPU is disabled
+    if (!(mem->io[0x40] & 0x80)) {
+        ppu->dot = 0;
+        ppu->ly = 0;
+        ppu->mode = 0;
+        ppu->stat_irq_line = false;
+        mem->io[0x44] = 0;
+        // Update STAT mode bits but don't trigger interrupts when LCD is off
+        mem->io[0x41] = (mem->io[0x41] & 0xFC) | 0x80;
+        return;
+    }
 
-        // If LCDC bit 7 is clear, PPU is disabled
-        uint8_t lcdc = mem_read8(mem, 0xFF40);
-        if (!(lcdc & 0x80)) {
-            ppu->dot = 0;
-            ppu->ly = 0;
-            ppu->mode = 0;
-            ppu->stat_irq_line = false;
-            mem->io[0x44] = 0;
-            // Update STAT mode bits but don't trigger interrupts when LCD is off
-            mem->io[0x41] = (mem->io[0x41] & 0xFC) | 0x80;
-            continue;
-        }
+    while (cycles > 0) {
 
-        // Each cycle increments dot counter by 1
-        ppu->dot++;
+        // Advance to the end of the current mode, or as far as the cycles allow
+        int remaining = ppu_mode_end(ppu->mode) - ppu->dot;
+        if (remaining < 1) {
+            remaining = 1;
+        }
+        if (cycles < remaining) {
+            ppu->dot += cycles;
+            return;
+        }
+        ppu->dot += remaining;
+        cycles -= remaining;
 
         switch (ppu->mode) {
 
         case 0: // HBlank
 
-            if (ppu->dot >= 456) {
-
-                // Increment LY at end of scanline
-                ppu->dot = 0;
-                ppu->ly++;
-                mem->io[0x44] = ppu->ly;
-
-                if (ppu->ly == 144) {
-                    // Enter VBlank
-                    ppu_mode_change(ppu, 1);
-                    ppu_update_stat(ppu, mem);
+            // Increment LY at end of scanline
+            ppu->dot = 0;
+            ppu->ly++;
+            mem->io[0x44] = ppu->ly;
 
-                    // Request VBlank interrupt
-                    mem->io[0x0F] |= 0x01;
+            if (ppu->ly == 144) {
+                // Enter VBlank
+                ppu_mode_change(ppu, 1);
+                ppu_update_stat(ppu, mem);
 
-                    // Present frame
-                    SDL_UpdateTexture(ppu->texture, NULL, ppu->framebuffer, SCREEN_WIDTH * sizeof(uint32_t));
-                    SDL_RenderClear(ppu->renderer);
-                    SDL_RenderCopy(ppu->renderer, ppu->texture, NULL, NULL);
-                    SDL_RenderPresent(ppu->renderer);
+                // Request VBlank interrupt
+                mem->io[0x0F] |= 0x01;
 
-                } else {
-                    // Next scanline is OAM scan
-                    ppu_mode_change(ppu, 2);
-                    ppu_update_stat(ppu, mem);
+                // Hand the frame over for presentation
+                if (!ppu->skip_frame) {
+                    ppu->present(ppu, ppu->present_data);
                 }
-            }
 
+            } else {
+                // Next scanline is OAM scan
+                ppu_mode_change(ppu, 2);
+                ppu_update_stat(ppu, mem);
+            }
             break;
 
         case 1: // VBlank
 
             // Increment LY at end of scanline
-            if (ppu->dot >= 456) {
-                ppu->dot = 0;
-                ppu->ly++;
-                mem->io[0x44] = ppu->ly;
-
-                // Reset LY and start OAM scan
-                if (ppu->ly > 153) {
-                    ppu->ly = 0;
-                    ppu->window_line = 0;
-                    mem->io[0x44] = 0;
-                    ppu_mode_change(ppu, 2);
-                }
-                ppu_update_stat(ppu, mem);
+            ppu->dot = 0;
+            ppu->ly++;
+            mem->io[0x44] = ppu->ly;
+
+            // Reset LY and start OAM scan
+            if (ppu->ly > 153) {
+                ppu->ly = 0;
+                ppu->window_line = 0;
+                ppu->skip_frame = ppu->skip_next;
+                mem->io[0x44] = 0;
+                ppu_mode_change(ppu, 2);
             }
+            ppu_update_stat(ppu, mem);
             break;
 
         case 2: // OAM scan
 
             // Change to drawing mode after 80 dots
-            if (ppu->dot >= 80) {
-                ppu_mode_change(ppu, 3);
-                ppu_update_stat(ppu, mem);
-            }
+            ppu_mode_change(ppu, 3);
+            ppu_update_stat(ppu, mem);
             break;
 
         case 3: // Drawing
 
             // Draw scanline at end of mode 3 and reset to HBlank
-            if (ppu->dot >= 252) {
-
+            if (ppu->skip_frame) {
+                // Only the window line counter carries over from a skipped line
+                if (ppu_window_start(ppu, mem) < SCREEN_WIDTH) {
+                    ppu->window_line++;
+                }
+            } else {
                 ppu->window_drawn = 0;
                 ppu_draw_tiles(ppu, mem);
                 if (ppu->window_drawn) {
                     ppu->window_line++;
                 }
                 ppu_draw_sprites(ppu, mem);
-                ppu_mode_change(ppu, 0);
-                ppu_update_stat(ppu, mem);
             }
+            ppu_mode_change(ppu, 0);
+            ppu_update_stat(ppu, mem);
             break;
         }
     }
 }
 
+/*
+ppu_cycles_to_event
+
+Return the number of cycles until the next mode transition, the only points at which
+the PPU can request an interrupt, or INT_MAX if the LCD is off.
+*/
+int ppu_cycles_to_event(PPU *ppu, Memory *mem) {
+    ppu_sync(ppu, mem);
+
+    if (!(mem->io[0x40] & 0x80)) {
+        return INT_MAX;
+    }
+
+    return ppu_mode_end(ppu->mode) - ppu->dot;
+}
+
+/*
+ppu_cycles_to_line
+
+Return the number of cycles until LY next changes, or INT_MAX if the LCD is off.
+*/
+int ppu_cycles_to_line(PPU *ppu, Memory *mem) {
+    ppu_sync(ppu, mem);
+
+    if (!(mem->io[0x40] & 0x80)) {
+        return INT_MAX;
+    }
+
+    return 456 - ppu->dot;
+}
+
 /*
 ppu_check_stat
 
@@ -461,12 +589,172 @@ void ppu_check_stat(PPU *ppu, Memory *mem) {
     }
 }
 
+/*
+ppu_catch_up
+
+Step the PPU through the cycles since it was last synced.
+*/
+void ppu_catch_up(PPU *ppu, Memory *mem) {
+    uint64_t elapsed = ppu->gb->scheduler.now - ppu->synced;
+
+    // Mark the PPU synced first, so register reads while drawing don't catch up again
+    ppu->synced = ppu->gb->scheduler.now;
+
+    // Only an LCD that is off goes this long without an event, and then every step is the same
+    ppu_step(ppu, mem, (elapsed > INT_MAX) ? INT_MAX : (int)elapsed);
+}
+
+/*
+ppu_schedule
+
+Register the next PPU event: the next mode boundary while a STAT interrupt source is
+enabled, otherwise the start of VBlank. The PPU must be in sync.
+*/
+void ppu_schedule(PPU *ppu, Memory *mem) {
+    Scheduler *sched = &ppu->gb->scheduler;
+
+    // No interrupts while the LCD is off
+    if (!(mem->io[0x40] & 0x80)) {
+        scheduler_cancel(sched, EVENT_PPU);
+        return;
+    }
+
+    int cycles;
+    if (mem->io[0x41] & 0x78) {
+        cycles = ppu_mode_end(ppu->mode) - ppu->dot;
+    } else if (ppu->ly < 144) {
+        cycles = (144 - ppu->ly) * 456 - ppu->dot;
+    } else {
+        cycles = (154 + 144 - ppu->ly) * 456 - ppu->dot;
+    }
+
+    // ppu_step always advances at least one dot to reach a boundary
+    if (cycles < 1) {
+        cycles = 1;
+    }
+
+    scheduler_schedule(sched, EVENT_PPU, ppu->synced + cycles);
+}
+
+/*
+ppu_event
+
+Handle a PPU event: catch the PPU up, which requests any interrupt, and register the
+next event.
+*/
+void ppu_event(PPU *ppu, Memory *mem) {
+    ppu_sync(ppu, mem);
+    ppu_schedule(ppu, mem);
+}
+
+/*
+ppu_write_register
+
+Write [value] to the LCD / PPU register at [addr]. The PPU is caught up first, and
+its next event is moved as LCDC, STAT and LYC decide which boundaries can interrupt.
+*/
+void ppu_write_register(PPU *ppu, Memory *mem, uint16_t addr, uint8_t value) {
+    ppu_sync(ppu, mem);
+
+    switch (addr) {
+
+    // STAT register - only bits 3-6 are writable, bit 7 always reads 1
+    case 0xFF41:
+        mem->io[0x41] = (mem->io[0x41] & 0x07) | (value & 0x78) | 0x80;
+        ppu_check_stat(ppu, mem);
+        break;
+
+    // Block writes to LY
+    case 0xFF44:
+        break;
+
+    // LYC register - re-evaluate STAT interrupt
+    case 0xFF45:
+        mem->io[0x45] = value;
+        ppu_check_stat(ppu, mem);
+        break;
+
+    default:
+        mem->io[addr - 0xFF00] = value;
+        break;
+    }
+
+    ppu_schedule(ppu, mem);
+}
+
+/*
+ppu_set_present
+
+Send finished frames to [present] with [data], or to ppu_publish if it is NULL.
+*/
+void ppu_set_present(PPU *ppu, PresentCallback present, void *data) {
+    ppu->present = present ? present : ppu_publish;
+    ppu->present_data = data;
+}
+
+/*
+ppu_publish
+
+Copy the finished framebuffer into the back buffer and swap it with the shared one,
+marking it fresh. The default presenter, called on the emulation thread.
+*/
+void ppu_publish(PPU *ppu, void *data) {
+    (void)data;
+    memcpy(ppu->frames[ppu->frame_back], ppu->framebuffer, sizeof(ppu->framebuffer));
+    ppu->frame_back = SDL_AtomicSet(&ppu->frame_shared, ppu->frame_back | FRAME_FRESH) & 3;
+}
+
+/*
+ppu_take_frame
+
+Swap the front buffer with the shared one if that holds a frame not presented yet.
+Return whether there was one. Called on the main thread.
+*/
+bool ppu_take_frame(PPU *ppu) {
+    if (!(SDL_AtomicGet(&ppu->frame_shared) & FRAME_FRESH)) {
+        return false;
+    }
+    ppu->frame_front = SDL_AtomicSet(&ppu->frame_shared, ppu->frame_front) & 3;
+    return true;
+}
+
+/*
+ppu_present
+
+Convert the front buffer to RGBA with the active display palette, straight into the
+streaming texture, and show it if there is a window. Called on the main thread.
+*/
+void ppu_present(PPU *ppu) {
+    if (!ppu->texture) {
+        return;
+    }
+
+    const uint32_t *colours = palettes[ppu->palette_id];
+    const uint8_t *frame = ppu->frames[ppu->frame_front];
+
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(ppu->texture, NULL, &pixels, &pitch) == 0) {
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            uint32_t *row = (uint32_t *)((uint8_t *)pixels + (size_t)y * pitch);
+            render_expand(row, &frame[y * SCREEN_WIDTH], colours, SCREEN_WIDTH);
+        }
+        SDL_UnlockTexture(ppu->texture);
+    }
+
+    SDL_RenderClear(ppu->renderer);
+    SDL_RenderCopy(ppu->renderer, ppu->texture, NULL, NULL);
+    SDL_RenderPresent(ppu->renderer);
+}
+
 /*
 ppu_palette_swap
 
-Cycle to the next selectable palette.
+Cycle to the next selectable palette. Frames hold shades, so the last frame is
+shown again in the new colours straight away. Called on the main thread.
 */
 void ppu_palette_swap(PPU *ppu) {
     ppu->palette_id++;
     ppu->palette_id %= NUM_PALETTES;
+    ppu_present(ppu);
 }
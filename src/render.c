@@ -0,0 +1,218 @@
+#include "render.h"
+
+#if RENDER_SIMD_ENABLED
+#include <immintrin.h>
+#endif
+
+/*
+render_decode_tile_scalar
+
+Decode a tile one pixel at a time by combining the two bitplanes of each row.
+*/
+static void render_decode_tile_scalar(const uint8_t *data, uint8_t tile[8][8], uint8_t tile_xflip[8][8]) {
+    for (int y = 0; y < 8; y++) {
+        uint8_t b1 = data[y << 1];
+        uint8_t b2 = data[(y << 1) + 1];
+
+        for (int x = 0; x < 8; x++) {
+            uint8_t bit = 7 - x;
+            uint8_t colour = ((b2 >> bit) & 1) << 1 | ((b1 >> bit) & 1);
+            tile[y][x] = colour;
+            tile_xflip[y][7 - x] = colour;
+        }
+    }
+}
+
+/*
+render_shade_scalar
+
+Map colour indices to shades one at a time.
+*/
+static void render_shade_scalar(uint8_t *out, const uint8_t *indices, uint8_t palette, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = (palette >> ((indices[i] & 3) << 1)) & 3;
+    }
+}
+
+/*
+render_expand_scalar
+
+Expand colour indices to pixels one at a time.
+*/
+static void render_expand_scalar(uint32_t *out, const uint8_t *indices, const uint32_t *colours, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = colours[indices[i] & 3];
+    }
+}
+
+render_decode_fn render_decode_tile = render_decode_tile_scalar;
+render_shade_fn render_shade = render_shade_scalar;
+render_expand_fn render_expand = render_expand_scalar;
+static const char *kernel_name = "scalar";
+
+#if RENDER_SIMD_ENABLED
+
+/*
+render_decode_tile_sse2
+
+Decode a tile a row at a time. Both bitplane bytes of a row are broadcast into one
+vector and tested against one bit per pixel; the low half gives bit 0 and the high
+half bit 1 of each index. Testing against the bits in reverse order gives the
+X-flipped row.
+*/
+__attribute__((target("sse2"))) static void render_decode_tile_sse2(const uint8_t *data, uint8_t tile[8][8],
+                                                                  uint8_t tile_xflip[8][8]) {
+    const __m128i bits = _mm_setr_epi8((char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, (char)0x80, 0x40, 0x20,
+                                       0x10, 0x08, 0x04, 0x02, 0x01);
+    const __m128i bits_xflip = _mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80, 0x01, 0x02, 0x04,
+                                             0x08, 0x10, 0x20, 0x40, (char)0x80);
+    const __m128i weights = _mm_setr_epi8(1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2);
+
+    for (int y = 0; y < 8; y++) {
+        __m128i planes = _mm_unpacklo_epi64(_mm_set1_epi8((char)data[y << 1]), _mm_set1_epi8((char)data[(y << 1) + 1]));
+
+        __m128i set = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(planes, bits), bits), weights);
+        _mm_storel_epi64((__m128i *)tile[y], _mm_or_si128(set, _mm_srli_si128(set, 8)));
+
+        set = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(planes, bits_xflip), bits_xflip), weights);
+        _mm_storel_epi64((__m128i *)tile_xflip[y], _mm_or_si128(set, _mm_srli_si128(set, 8)));
+    }
+}
+
+/*
+render_shade_sse2
+
+Map 16 indices at a time, selecting each shade with one compare per palette entry.
+*/
+__attribute__((target("sse2"))) static void render_shade_sse2(uint8_t *out, const uint8_t *indices, uint8_t palette,
+                                                            int count) {
+    const __m128i mask = _mm_set1_epi8(3);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i index = _mm_and_si128(_mm_loadu_si128((const __m128i *)&indices[i]), mask);
+        __m128i shades = _mm_setzero_si128();
+        for (int c = 0; c < 4; c++) {
+            __m128i hit = _mm_cmpeq_epi8(index, _mm_set1_epi8((char)c));
+            shades = _mm_or_si128(shades, _mm_and_si128(hit, _mm_set1_epi8((char)((palette >> (c << 1)) & 3))));
+        }
+        _mm_storeu_si128((__m128i *)&out[i], shades);
+    }
+
+    render_shade_scalar(out + i, indices + i, palette, count - i);
+}
+
+/*
+render_expand_sse2
+
+Expand 16 indices at a time. SSE2 has no variable shuffle, so each group of four
+pixels selects its colour with one compare per palette entry.
+*/
+__attribute__((target("sse2"))) static void render_expand_sse2(uint32_t *out, const uint8_t *indices,
+                                                             const uint32_t *colours, int count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi8(3);
+    __m128i palette[4];
+    for (int c = 0; c < 4; c++) {
+        palette[c] = _mm_set1_epi32((int)colours[c]);
+    }
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_and_si128(_mm_loadu_si128((const __m128i *)&indices[i]), mask);
+        __m128i words[2] = {_mm_unpacklo_epi8(bytes, zero), _mm_unpackhi_epi8(bytes, zero)};
+
+        for (int w = 0; w < 2; w++) {
+            __m128i dwords[2] = {_mm_unpacklo_epi16(words[w], zero), _mm_unpackhi_epi16(words[w], zero)};
+
+            for (int d = 0; d < 2; d++) {
+                __m128i pixels = zero;
+                for (int c = 0; c < 4; c++) {
+                    __m128i hit = _mm_cmpeq_epi32(dwords[d], _mm_set1_epi32(c));
+                    pixels = _mm_or_si128(pixels, _mm_and_si128(hit, palette[c]));
+                }
+                _mm_storeu_si128((__m128i *)&out[i + w * 8 + d * 4], pixels);
+            }
+        }
+    }
+
+    render_expand_scalar(out + i, indices + i, colours, count - i);
+}
+
+/*
+render_shade_avx2
+
+Map 32 indices at a time with one byte shuffle of the four shades.
+*/
+__attribute__((target("avx2"))) static void render_shade_avx2(uint8_t *out, const uint8_t *indices, uint8_t palette,
+                                                            int count) {
+    const __m256i mask = _mm256_set1_epi8(3);
+    const __m256i table = _mm256_setr_epi8(palette & 3, (palette >> 2) & 3, (palette >> 4) & 3, (palette >> 6) & 3, 0, 0,
+                                           0, 0, 0, 0, 0, 0, 0, 0, 0, 0, palette & 3, (palette >> 2) & 3,
+                                           (palette >> 4) & 3, (palette >> 6) & 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i index = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)&indices[i]), mask);
+        _mm256_storeu_si256((__m256i *)&out[i], _mm256_shuffle_epi8(table, index));
+    }
+
+    render_shade_scalar(out + i, indices + i, palette, count - i);
+}
+
+/*
+render_expand_avx2
+
+Expand 8 indices at a time, widening them to 32 bits and looking each pixel up with
+one cross-lane shuffle of the palette.
+*/
+__attribute__((target("avx2"))) static void render_expand_avx2(uint32_t *out, const uint8_t *indices,
+                                                             const uint32_t *colours, int count) {
+    const __m256i mask = _mm256_set1_epi32(3);
+    const __m256i palette = _mm256_setr_epi32((int)colours[0], (int)colours[1], (int)colours[2], (int)colours[3],
+                                              (int)colours[0], (int)colours[1], (int)colours[2], (int)colours[3]);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i index = _mm256_and_si256(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)&indices[i])), mask);
+        _mm256_storeu_si256((__m256i *)&out[i], _mm256_permutevar8x32_epi32(palette, index));
+    }
+
+    render_expand_scalar(out + i, indices + i, colours, count - i);
+}
+
+#endif
+
+/*
+render_init
+
+Pick the fastest kernels the host supports. The CPU features come from cpuid,
+including whether the OS saves AVX state.
+*/
+void render_init(void) {
+#if RENDER_SIMD_ENABLED
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse2")) {
+        render_decode_tile = render_decode_tile_sse2;
+        render_shade = render_shade_sse2;
+        render_expand = render_expand_sse2;
+        kernel_name = "SSE2";
+    }
+
+    if (__builtin_cpu_supports("avx2")) {
+        render_shade = render_shade_avx2;
+        render_expand = render_expand_avx2;
+        kernel_name = "AVX2";
+    }
+#endif
+}
+
+/*
+render_kernel_name
+
+Return the name of the instruction set the kernels in use were written for.
+*/
+const char *render_kernel_name(void) {
+    return kernel_name;
+}
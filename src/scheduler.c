@@ -0,0 +1,98 @@
+#include "scheduler.h"
+#include "gb.h"
+#include "memory.h"
+#include "ppu.h"
+
+/*
+scheduler_init
+
+Reset the master clock and clear all pending events.
+*/
+void scheduler_init(Scheduler *sched) {
+    sched->now = 0;
+    sched->next = EVENT_NEVER;
+    for (int i = 0; i < NUM_EVENTS; i++) {
+        sched->deadline[i] = EVENT_NEVER;
+    }
+}
+
+/*
+scheduler_update_next
+
+Recompute the earliest pending deadline. There are only a few event types, so a scan
+of the deadline table is cheaper than keeping a heap ordered.
+*/
+static void scheduler_update_next(Scheduler *sched) {
+    uint64_t next = EVENT_NEVER;
+    for (int i = 0; i < NUM_EVENTS; i++) {
+        if (sched->deadline[i] < next) {
+            next = sched->deadline[i];
+        }
+    }
+    sched->next = next;
+}
+
+/*
+scheduler_schedule
+
+Set the deadline of the event [type] to the absolute cycle [time], replacing any
+pending deadline it had.
+*/
+void scheduler_schedule(Scheduler *sched, EventType type, uint64_t time) {
+    sched->deadline[type] = time;
+    if (time < sched->next) {
+        sched->next = time;
+    } else {
+        scheduler_update_next(sched);
+    }
+}
+
+/*
+scheduler_cancel
+
+Remove the pending deadline of the event [type], if any.
+*/
+void scheduler_cancel(Scheduler *sched, EventType type) {
+    if (sched->deadline[type] != EVENT_NEVER) {
+        sched->deadline[type] = EVENT_NEVER;
+        scheduler_update_next(sched);
+    }
+}
+
+/*
+scheduler_dispatch
+
+Run every event whose deadline has been reached, earliest first. Each handler
+registers the next deadline of its component.
+*/
+void scheduler_dispatch(GB *gb) {
+    Scheduler *sched = &gb->scheduler;
+
+    while (sched->next <= sched->now) {
+
+        // Find the event that is due
+        uint64_t time = sched->next;
+        int type = 0;
+        while (sched->deadline[type] != time) {
+            type++;
+        }
+
+        sched->deadline[type] = EVENT_NEVER;
+        scheduler_update_next(sched);
+
+        switch (type) {
+        case EVENT_TIMER:
+            mem_timer_event(gb->mem);
+            break;
+        case EVENT_SERIAL:
+            mem_serial_event(gb->mem, time);
+            break;
+        case EVENT_PPU:
+            ppu_event(gb->ppu, gb->mem);
+            break;
+        case EVENT_DMA:
+            mem_dma_event(gb->mem);
+            break;
+        }
+    }
+}